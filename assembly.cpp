@@ -1,19 +1,19 @@
 #include <algorithm>
 #include <bitset>
-#include <cassert>
 #include <chrono>
 #include <cstdlib>
+#include <cstring>
 #include <ctime>
-#include <fstream>
+#include <filesystem>
 #include <iostream>
 #include <iomanip>
-#include <map>
 #include <memory>
+#include <numeric>
 #include <regex>
 #include <sstream>
-#include <stack>
 #include <string>
 #include <type_traits>
+#include <unordered_set>
 #include <vector>
 
 #include "declarations.hpp"
@@ -23,118 +23,1382 @@
 // #define DIAG
 #include "diag.hpp"
 
+#include "image.hpp"
+#include "metadata.hpp"
+#include "batch.hpp"
+#include "resolver.hpp"
+#include "refs_format.hpp"
+#include "interner.hpp"
+#include "identity.hpp"
+#include "members.hpp"
+#include "signatures.hpp"
+#include "cil.hpp"
+#include "user_strings.hpp"
+#include "attributes.hpp"
+#include "resources.hpp"
 
-static constexpr byte Unmapped = byte(-1);
-typedef byte TablesMapping[TABLES_MAX_COUNT];
 
+using namespace std;
+
+
+class matcher {
+public:
+  virtual ~matcher() {}
+
+  virtual bool operator()(const string& s) const = 0;
+};
+
+struct matcher_any : public matcher {
+  bool operator()(const string& s) const override {
+    return true;
+  }
+};
+
+struct matcher_text : public matcher {
+  regex _re;
+
+  matcher_text(const string& text)
+    : _re(text) { }
+
+  bool operator()(const string& s) const override {
+    return regex_match(s, _re);
+  }
+};
+
+
+typedef vector<unique_ptr<matcher>> matchers_list;
+// Names are string_interner ids, their text is only looked up for output.
+// Assemblies are indices into file_results::assemblies.
+typedef vector<pair<dword, dword>> type_refs_list;
+
+struct type_refs_group {
+  explicit type_refs_group(dword assembly)
+    : assembly(assembly) {}
+
+  dword assembly;
+  vector<dword> types;
+  vector<vector<dword>> members;  // with --members, along types
+};
+
+// One group per matching AssemblyRef row, in the order they are first referenced.
+typedef vector<type_refs_group> type_refs_groups;
+
+struct file_results {
+  const char* error = nullptr;
+  bool skipped = false;     // not a managed image
+  const char* over_budget = nullptr;  // why the file was given up
+  image_kind kind = image_kind::corrupt;
+  vector<assembly_identity> assemblies;   // matching ones, in the order first referenced
+  type_refs_list refs;      // either these
+  type_refs_groups groups;  // or these with --group
+  vector<vector<dword>> members;  // with --members, names along refs
+  vector<string> diagnostics;
+  resource_range resource;  // with --extract-resource, where it is in the file
+};
+
+struct collect_settings {
+  bool grouped;   // into type_refs_groups
+  bool dedupe;    // only the first of the rows with the same identity (see ref_identities)
+  bool defined;   // the types the image defines rather than those it references
+  bool members;   // the MemberRefs of every referenced type too
+  bool signatures;  // members with their signatures rather than names only
+  bool instantiations;  // the generic instantiations rather than the types
+  bool pinvoke;   // the native imports rather than the types
+  bool calls;     // the call sites in method bodies rather than the types, needs a mapping
+  bool strings;   // the string literals matching rather than the types, with calls those loaded
+  bool attributes;  // the custom attributes of the types and the assembly rather than the types
+  const matcher* attribute_args;  // attribute types whose arguments are decoded too, if any
+  bool resources;  // the manifest resources rather than the types, needs a mapping
+  const char* extract_resource;  // only the resource of this name, located for extraction
+};
+
+// The image's own assembly. Netmodules have no Assembly row, the module name stands for it.
+static assembly_identity own_identity(const metadata& meta, string_interner& strings) {
+  if (meta.rows_count(TableFlag::Assembly)) {
+    AssemblyTable table;
+    meta.read_row(0, table);
+    return identity_reader(meta, strings).assembly(table);
+  }
+
+  ModuleTable table = {};
+  if (meta.rows_count(TableFlag::Module)) {
+    meta.read_row(0, table);
+  }
+
+  assembly_identity identity;
+  identity.name = strings.intern(meta.get_string(table.name));
+  identity.culture = identity.token = strings.intern("");
+  return identity;
+}
+
+static bool any_match(const matchers_list& matchers, const string& s) {
+  return any_of(matchers.begin(), matchers.end(),
+    [&s] (auto& matcher) { return (*matcher)(s); });
+}
+
+/*
+
+  Indices into file_results::assemblies (and groups with --group) by
+  AssemblyRef row, then one more slot for the image's own assembly.
+  Identities are read and matched the first time a slot is asked for.
+
+*/
+class assembly_slots {
+public:
+  assembly_slots(const metadata& meta, const matchers_list& matchers, const collect_settings& settings,
+      string_interner& strings, file_results& dst)
+    : _meta(meta), _matchers(matchers), _grouped(settings.grouped), _strings(strings)
+    , _identities(meta, strings), _dst(dst)
+    , _slots(meta.rows_count(TableFlag::AssemblyRef) + 1, -2) {}
+
+  dword self() const {
+    return dword(_slots.size() - 1);
+  }
+
+  // Index of the slot's assembly, -1 if it is filtered out.
+  int index(dword slot) {
+    auto& a = _slots[slot];
+    if (a != -2) {
+      return a;
+    }
+
+    assembly_identity identity;
+    if (slot == self()) {
+      identity = own_identity(_meta, _strings);
+    } else {
+      AssemblyRefTable table;
+      _meta.read_row(slot, table);
+      identity = _identities.assembly_ref(table);
+    }
+
+    if (!any_match(_matchers, string(_strings.get(identity.name)))) {
+      return a = -1;
+    }
+
+    a = int(_dst.assemblies.size());
+    _dst.assemblies.push_back(identity);
+
+    if (_grouped) {
+      _dst.groups.emplace_back(dword(a));
+    }
+
+    return a;
+  }
+
+private:
+  const metadata& _meta;
+  const matchers_list& _matchers;
+  bool _grouped;
+  string_interner& _strings;
+  identity_reader _identities;
+  file_results& _dst;
+  vector<int> _slots;   // not seen yet (-2), filtered out (-1) or the index
+};
+
+// Gives up half way (with budget.exceeded() set) once the file is over its budget.
+static void collect_type_refs(const metadata& meta, const matchers_list& matchers,
+    const collect_settings& settings, string_interner& strings, file_budget& budget,
+    file_results& dst) {
+
+  auto typeRefsCount = meta.rows_count(TableFlag::TypeRef);
+  if (!budget.charge(typeRefsCount * sizeof(type_ref_resolver::type_ref))) {
+    return;
+  }
+
+  type_ref_resolver resolver(meta);
+
+  unique_ptr<ref_identities> identities;
+  if (settings.dedupe) {
+    if (!budget.charge((typeRefsCount + meta.rows_count(TableFlag::AssemblyRef)) * 4 * sizeof(dword))) {
+      return;
+    }
+
+    identities = make_unique<ref_identities>(meta, resolver);
+  }
+
+  scope_resolver scopes(meta, resolver);
+
+  unique_ptr<member_refs_index> memberRefs;
+  if (settings.members) {
+    if (!budget.charge(member_refs_index::footprint(meta))) {
+      return;
+    }
+
+    memberRefs = make_unique<member_refs_index>(meta);
+  }
+
+  // With --dedupe, members of a type go where the first row of its identity
+  // was listed: its assembly (group) and position there.
+  vector<pair<int, dword>> memberSlots;
+  if (memberRefs && identities) {
+    memberSlots.assign(typeRefsCount, { -1, NO_ROW });
+  }
+
+  auto memberList = [&] (pair<int, dword> slot) -> vector<dword>& {
+    return settings.grouped ? dst.groups[slot.first].members[slot.second] : dst.members[slot.second];
+  };
+
+  unique_ptr<type_def_resolver> typeDefs;
+  unique_ptr<signature_decoder> signatures;
+  if (memberRefs && settings.signatures) {
+    typeDefs = make_unique<type_def_resolver>(meta);
+    signatures = make_unique<signature_decoder>(meta, resolver, *typeDefs);
+  }
+
+  // Overloads share a name, each name (or signature) is listed once.
+  unordered_set<dword> seen;
+  string text;
+  auto addMembers = [&] (dword row, vector<dword>& dst) {
+    seen.clear();
+    seen.insert(dst.begin(), dst.end());
+
+    auto range = memberRefs->members(row);
+    for (auto it = range.first; it != range.second; ++it) {
+      MemberRefTable member;
+      meta.read_row(*it, member);
+
+      // A malformed signature leaves the name alone.
+      string_view name = meta.get_string(member.name);
+      text.clear();
+      if (signatures && signatures->member(member.signature, name, text)) {
+        name = text;
+      }
+
+      auto id = strings.intern(name);
+      if (seen.insert(id).second) {
+        dst.push_back(id);
+      }
+    }
+  };
+
+  assembly_slots assemblies(meta, matchers, settings, strings, dst);
+  const dword selfSlot = assemblies.self();
+
+  for (dword i = 0; i < typeRefsCount; ++i) {
+    if (!budget.tick()) {
+      return;
+    }
+
+    auto& ref = resolver.resolve(i);
+    if (!budget.charge(ref.name.size())) {
+      return;
+    }
+
+    if (ref.broken) {
+      continue;
+    }
+
+    auto assemblyRow = scopes.assembly(i);
+    if (assemblyRow == NO_ROW) {
+      continue;
+    }
+
+    auto slot = assemblyRow == scope_resolver::SELF ? selfSlot : assemblyRow;
+    if (identities) {
+      if (slot != selfSlot) {
+        slot = identities->assembly(slot);
+      }
+
+      auto first = identities->type(i, slot);
+      if (first != i) {
+        if (memberRefs && memberSlots[first].first >= 0) {
+          addMembers(i, memberList(memberSlots[first]));
+        }
+        continue;
+      }
+    }
+
+    auto a = assemblies.index(slot);
+    if (a < 0) {
+      continue;
+    }
+
+    if (!budget.charge(sizeof(type_refs_list::value_type))) {
+      return;
+    }
+
+    auto type = strings.intern(ref.name);
+    if (settings.grouped) {
+      dst.groups[a].types.push_back(type);
+    } else {
+      dst.refs.push_back(make_pair(dword(a), type));
+    }
+
+    if (memberRefs) {
+      auto& members = settings.grouped ? dst.groups[a].members : dst.members;
+      if (!memberSlots.empty()) {
+        memberSlots[i] = { a, dword(members.size()) };
+      }
+
+      members.emplace_back();
+      addMembers(i, members.back());
+
+      if (!budget.charge(members.back().size() * sizeof(dword))) {
+        return;
+      }
+    }
+  }
+
+  dst.diagnostics = resolver.diagnostics();
+  if (typeDefs) {
+    auto& more = typeDefs->diagnostics();
+    dst.diagnostics.insert(dst.diagnostics.end(), more.begin(), more.end());
+  }
+}
+
+
+// Same as collect_type_refs(), for the TypeDef rows, all of them in the image's own assembly.
+static void collect_defined_types(const metadata& meta, const matchers_list& matchers,
+    const collect_settings& settings, string_interner& strings, file_budget& budget,
+    file_results& dst) {
+
+  auto typeDefsCount = meta.rows_count(TableFlag::TypeDef);
+  if (!budget.charge(typeDefsCount * (sizeof(string) + sizeof(dword)))) {
+    return;
+  }
+
+  auto identity = own_identity(meta, strings);
+  if (!any_match(matchers, string(strings.get(identity.name)))) {
+    return;
+  }
+
+  dst.assemblies.push_back(identity);
+  if (settings.grouped) {
+    dst.groups.emplace_back(0);
+  }
+
+  type_def_resolver resolver(meta);
+
+  // The first row is the <Module> pseudo type holding global members.
+  for (dword i = 1; i < typeDefsCount; ++i) {
+    if (!budget.tick()) {
+      return;
+    }
+
+    auto& typeName = resolver.resolve(i);
+    if (!budget.charge(typeName.size() + sizeof(type_refs_list::value_type))) {
+      return;
+    }
+
+    auto type = strings.intern(typeName);
+    if (settings.grouped) {
+      dst.groups[0].types.push_back(type);
+    } else {
+      dst.refs.push_back(make_pair(dword(0), type));
+    }
+  }
+
+  dst.diagnostics = resolver.diagnostics();
+}
+
+
+/*
+
+  Same as collect_type_refs(), for the generic instantiations the image
+  makes: GENERICINST TypeSpec rows as types and MethodSpec rows as
+  "Owner.Method<a,b>", listed under the assembly defining the generic
+  type (or the type declaring the generic method). Each is listed once.
+
+*/
+static void collect_instantiations(const metadata& meta, const matchers_list& matchers,
+    const collect_settings& settings, string_interner& strings, file_budget& budget,
+    file_results& dst) {
+
+  auto typeRefsCount = meta.rows_count(TableFlag::TypeRef);
+  auto typeDefsCount = meta.rows_count(TableFlag::TypeDef);
+  if (!budget.charge(typeRefsCount * sizeof(type_ref_resolver::type_ref)
+      + typeDefsCount * (sizeof(string) + sizeof(dword)))) {
+    return;
+  }
+
+  type_ref_resolver resolver(meta);
+  type_def_resolver typeDefs(meta);
+  scope_resolver scopes(meta, resolver);
+  signature_decoder signatures(meta, resolver, typeDefs);
+  assembly_slots assemblies(meta, matchers, settings, strings, dst);
+
+  unordered_set<qword> seen;   // assembly index and type
+  auto add = [&] (TableFlag table, dword row, string_view text) {
+    auto slot = assemblies.self();
+    if (table == TableFlag::TypeRef) {
+      if (resolver.resolve(row).broken) {
+        return true;
+      }
+
+      slot = scopes.assembly(row);
+      if (slot == NO_ROW) {
+        return true;
+      }
+      if (slot == scope_resolver::SELF) {
+        slot = assemblies.self();
+      }
+    }
+
+    auto a = assemblies.index(slot);
+    if (a < 0) {
+      return true;
+    }
+
+    auto type = strings.intern(text);
+    if (!seen.insert(qword(a) << 32 | type).second) {
+      return true;
+    }
+
+    if (!budget.charge(text.size() + sizeof(type_refs_list::value_type))) {
+      return false;
+    }
+
+    if (settings.grouped) {
+      dst.groups[a].types.push_back(type);
+    } else {
+      dst.refs.push_back(make_pair(dword(a), type));
+    }
+    return true;
+  };
+
+  for (dword i = 0; i < meta.rows_count(TableFlag::TypeSpec); ++i) {
+    if (!budget.tick()) {
+      return;
+    }
+
+    TableFlag table;
+    auto generic = signature_decoder::generic_type(meta, i, table);
+    if (generic == NO_ROW) {
+      continue;
+    }
+
+    auto text = signatures.type_spec(i);
+    if (text && !add(table, generic, *text)) {
+      return;
+    }
+  }
+
+  string text;
+  for (dword i = 0; i < meta.rows_count(TableFlag::MethodSpec); ++i) {
+    if (!budget.tick()) {
+      return;
+    }
+
+    TableFlag table;
+    dword owner;
+    text.clear();
+    if (signatures.method_spec(i, text, table, owner) && !add(table, owner, text)) {
+      return;
+    }
+  }
+
+  dst.diagnostics = resolver.diagnostics();
+  auto& more = typeDefs.diagnostics();
+  dst.diagnostics.insert(dst.diagnostics.end(), more.begin(), more.end());
+}
+
+
+/*
+
+  Same as collect_defined_types(), for the native imports (ImplMap rows):
+  the modules imported from are the types, listed in the order first
+  imported from, their entry points the members, each as
+  "EntryPoint (Owner.Method)". Only the metadata is read, no IL.
+
+*/
+static void collect_pinvokes(const metadata& meta, const matchers_list& matchers,
+    const collect_settings& settings, string_interner& strings, file_budget& budget,
+    file_results& dst) {
+
+  // Most images import nothing, they make no records.
+  auto implMapsCount = meta.rows_count(TableFlag::ImplMap);
+  if (!implMapsCount) {
+    return;
+  }
+
+  auto typeDefsCount = meta.rows_count(TableFlag::TypeDef);
+  auto moduleRefsCount = meta.rows_count(TableFlag::ModuleRef);
+  if (!budget.charge(typeDefsCount * (sizeof(string) + sizeof(dword)) + moduleRefsCount * sizeof(dword))) {
+    return;
+  }
+
+  auto identity = own_identity(meta, strings);
+  if (!any_match(matchers, string(strings.get(identity.name)))) {
+    return;
+  }
+
+  dst.assemblies.push_back(identity);
+  if (settings.grouped) {
+    dst.groups.emplace_back(0);
+  }
+
+  auto& members = settings.grouped ? dst.groups[0].members : dst.members;
+
+  type_def_resolver typeDefs(meta);
+  vector<dword> modules(moduleRefsCount, NO_ROW);   // index in members by ModuleRef row
+  unordered_set<qword> seen;  // module index and entry point
+  string text;
+
+  for (dword i = 0; i < implMapsCount; ++i) {
+    if (!budget.tick()) {
+      return;
+    }
+
+    ImplMapTable row;
+    meta.read_row(i, row);
+
+    // Fields may only be forwarded in theory.
+    TableFlag table;
+    auto method = coded_index<MemberForwarded>::decode(row.member_forwarded, table);
+    if (table != TableFlag::MethodDef) {
+      continue;
+    }
+
+    MethodDefTable def;
+    meta.read_row(method, def);
+
+    auto& module = modules[row.import_scope - 1];
+    if (module == NO_ROW) {
+      ModuleRefTable scope;
+      meta.read_row(row.import_scope - 1, scope);
+
+      auto name = strings.intern(meta.get_string(scope.name));
+      module = dword(members.size());
+      if (settings.grouped) {
+        dst.groups[0].types.push_back(name);
+      } else {
+        dst.refs.push_back(make_pair(dword(0), name));
+      }
+      members.emplace_back();
+    }
+
+    auto entryPoint = meta.get_string(row.import_name);
+    auto methodName = meta.get_string(def.name);
+    text.assign(*entryPoint ? entryPoint : methodName).append(" (");
+
+    auto owner = typeDefs.method_owner(method);
+    if (owner != NO_ROW) {
+      text.append(typeDefs.resolve(owner)).append(".");
+    }
+    text.append(methodName).append(")");
+
+    if (!budget.charge(text.size() + sizeof(dword))) {
+      return;
+    }
+
+    auto id = strings.intern(text);
+    if (seen.insert(qword(module) << 32 | id).second) {
+      members[module].push_back(id);
+    }
+  }
+
+  dst.diagnostics = typeDefs.diagnostics();
+}
+
+
+/*
+
+  Same as collect_defined_types(), for what the methods of the image call,
+  create and load in their bodies (call, callvirt, newobj, ldfld and
+  ldsfld): the methods are the types, the members and fields their IL
+  refers to are the members, each listed once as "Owner.Name".
+
+  With --strings the members are the literals the methods load (ldstr)
+  instead, those the matchers take; the assembly is not matched then.
+
+  Bodies are scanned in RVA order, which is the order they are laid out in
+  the image, so the mapping is read through sequentially. Methods are
+  listed in that order too, those without call sites are left out.
+
+*/
+static void collect_call_sites(const metadata& meta, const image_loader& image,
+    const image_mapping& mapping, const matchers_list& matchers,
+    const collect_settings& settings, string_interner& strings, file_budget& budget,
+    file_results& dst) {
+
+  auto methodsCount = meta.rows_count(TableFlag::MethodDef);
+  if (!methodsCount) {
+    return;
+  }
+
+  auto typeRefsCount = meta.rows_count(TableFlag::TypeRef);
+  auto typeDefsCount = meta.rows_count(TableFlag::TypeDef);
+  if (!budget.charge(typeRefsCount * sizeof(type_ref_resolver::type_ref)
+      + typeDefsCount * (sizeof(string) + sizeof(dword))
+      + methodsCount * sizeof(pair<dword, dword>))) {
+    return;
+  }
+
+  auto identity = own_identity(meta, strings);
+  if (!settings.strings && !any_match(matchers, string(strings.get(identity.name)))) {
+    return;
+  }
+
+  dst.assemblies.push_back(identity);
+  if (settings.grouped) {
+    dst.groups.emplace_back(0);
+  }
+
+  auto& members = settings.grouped ? dst.groups[0].members : dst.members;
+
+  user_strings literals(meta);
+  type_ref_resolver resolver(meta);
+  type_def_resolver typeDefs(meta);
+  signature_decoder signatures(meta, resolver, typeDefs);
+  method_bodies bodies(image, mapping);
+
+  // Methods with a body, by RVA.
+  vector<pair<dword, dword>> methods;
+  methods.reserve(methodsCount);
+  for (dword i = 0; i < methodsCount; ++i) {
+    MethodDefTable def;
+    meta.read_row(i, def);
+
+    if (def.rva) {
+      methods.emplace_back(def.rva, i);
+    }
+  }
+  sort(methods.begin(), methods.end());
+
+  string text;
+
+  // "Owner.Name" of a MethodDef or Field row, the owner left out if there is none.
+  auto defined = [&] (dword owner, dword name) {
+    text.clear();
+    if (owner != NO_ROW) {
+      text.append(typeDefs.resolve(owner)).append(".");
+    }
+    text.append(meta.get_string(name));
+  };
+
+  // Interned names of the tokens seen so far, NO_ROW for those which cannot be named.
+  unordered_map<dword, dword> targets;
+  auto target = [&] (dword token) {
+    auto inserted = targets.try_emplace(token, NO_ROW);
+    auto& id = inserted.first->second;
+    if (!inserted.second) {
+      return id;
+    }
+
+    if (token >> 24 == USER_STRING_TOKEN) {
+      text.clear();
+      if (!literals.get(token & METADATA_ROWS_MAX, text) || !any_match(matchers, text)) {
+        return id;
+      }
+
+      return id = strings.intern(text);
+    }
+
+    auto table = TableFlag(token >> 24);
+    auto row = (token & METADATA_ROWS_MAX) - 1;
+    if (row >= meta.rows_count(table)) {
+      return id;
+    }
+
+    switch (table) {
+      case TableFlag::MethodDef: {
+        MethodDefTable def;
+        meta.read_row(row, def);
+        defined(typeDefs.method_owner(row), def.name);
+        break;
+      }
+
+      case TableFlag::Field: {
+        FieldTable field;
+        meta.read_row(row, field);
+        defined(typeDefs.field_owner(row), field.name);
+        break;
+      }
+
+      case TableFlag::MemberRef: {
+        MemberRefTable ref;
+        meta.read_row(row, ref);
+
+        TableFlag parentTable;
+        auto parent = coded_index<MemberRefParent>::decode(ref.cls, parentTable);
+
+        // A null class leaves the member without its owner.
+        text.clear();
+        if (ref.cls && parent < meta.rows_count(parentTable)) {
+          if (parentTable == TableFlag::TypeRef) {
+            text.append(resolver.resolve(parent).name).append(".");
+          } else if (parentTable == TableFlag::TypeDef) {
+            text.append(typeDefs.resolve(parent)).append(".");
+          } else if (parentTable == TableFlag::TypeSpec) {
+            if (auto spec = signatures.type_spec(parent)) {
+              text.append(*spec).append(".");
+            }
+          }
+        }
+        text.append(meta.get_string(ref.name));
+        break;
+      }
+
+      case TableFlag::MethodSpec: {
+        TableFlag ownerTable;
+        dword owner;
+        text.clear();
+        if (!signatures.method_spec(row, text, ownerTable, owner)) {
+          return id;
+        }
+        break;
+      }
+
+      default:
+        return id;
+    }
+
+    return id = strings.intern(text);
+  };
+
+  vector<dword> calls;
+  unordered_set<dword> seen;
+  size_t malformed = 0;
+
+  for (auto& method : methods) {
+    if (!budget.tick()) {
+      return;
+    }
+
+    const ::byte* code;
+    dword size;
+    if (!bodies.code(method.first, code, size)) {
+      ++malformed;
+      continue;
+    }
+
+    calls.clear();
+    seen.clear();
+
+    auto complete = scan_call_sites(code, size, [&] (cil_opcode op, dword token) {
+      if ((op == cil_opcode::LDSTR) != settings.strings) {
+        return;
+      }
+
+      auto id = target(token);
+      if (id != NO_ROW && seen.insert(id).second) {
+        calls.push_back(id);
+      }
+    });
+
+    if (!complete) {
+      ++malformed;
+    }
+
+    if (calls.empty()) {
+      continue;
+    }
+
+    if (!budget.charge(calls.size() * sizeof(dword) + sizeof(type_refs_list::value_type))) {
+      return;
+    }
+
+    MethodDefTable def;
+    meta.read_row(method.second, def);
+    defined(typeDefs.method_owner(method.second), def.name);
+
+    auto caller = strings.intern(text);
+    if (settings.grouped) {
+      dst.groups[0].types.push_back(caller);
+    } else {
+      dst.refs.push_back(make_pair(dword(0), caller));
+    }
+    members.emplace_back(calls);
+  }
+
+  dst.diagnostics = resolver.diagnostics();
+  auto& more = typeDefs.diagnostics();
+  dst.diagnostics.insert(dst.diagnostics.end(), more.begin(), more.end());
+
+  if (malformed) {
+    dst.diagnostics.push_back(to_string(malformed) + " method bodies are malformed");
+  }
+}
+
+
+/*
+
+  Same as collect_defined_types(), for the string literals of the image
+  (the #US heap) the matchers take, in heap order. They are listed as
+  types of the image's own assembly, which is not matched itself.
+
+*/
+static void collect_user_strings(const metadata& meta, const matchers_list& matchers,
+    const collect_settings& settings, string_interner& strings, file_budget& budget,
+    file_results& dst) {
+
+  user_strings literals(meta);
+  if (!literals.size()) {
+    return;
+  }
+
+  // Stops the heap walk once the file is over its budget.
+  auto add = [&] (dword, const string& text) {
+    if (!budget.tick()) {
+      return false;
+    }
+
+    if (!any_match(matchers, text)) {
+      return true;
+    }
+
+    if (!budget.charge(text.size() + sizeof(type_refs_list::value_type))) {
+      return false;
+    }
+
+    // Images without literals make no records.
+    if (dst.assemblies.empty()) {
+      dst.assemblies.push_back(own_identity(meta, strings));
+      if (settings.grouped) {
+        dst.groups.emplace_back(0);
+      }
+    }
+
+    auto literal = strings.intern(text);
+    if (settings.grouped) {
+      dst.groups[0].types.push_back(literal);
+    } else {
+      dst.refs.push_back(make_pair(dword(0), literal));
+    }
+
+    return true;
+  };
+
+  if (!literals.for_each(add)) {
+    dst.diagnostics.push_back("#US heap is malformed");
+  }
+}
+
+
+/*
+
+  Same as collect_defined_types(), for the custom attributes applied to the
+  types and to the assembly itself, which is listed as <Assembly>: those
+  with attributes are the types, their attributes the members. Value
+  blobs are only decoded for the attribute types settings.attribute_args
+  takes, the others are listed by their type alone; "(?)" follows those
+  whose blob is malformed or has an enum of unknown size.
+
+*/
+static void collect_attributes(const metadata& meta, const matchers_list& matchers,
+    const collect_settings& settings, string_interner& strings, file_budget& budget,
+    file_results& dst) {
+
+  auto typeRefsCount = meta.rows_count(TableFlag::TypeRef);
+  auto typeDefsCount = meta.rows_count(TableFlag::TypeDef);
+  if (!budget.charge(typeRefsCount * sizeof(type_ref_resolver::type_ref)
+      + typeDefsCount * (sizeof(string) + sizeof(dword))
+      + meta.rows_count(TableFlag::CustomAttribute) * 2 * sizeof(dword))) {
+    return;
+  }
+
+  auto identity = own_identity(meta, strings);
+  if (!any_match(matchers, string(strings.get(identity.name)))) {
+    return;
+  }
 
-using namespace std;
+  dst.assemblies.push_back(identity);
+  if (settings.grouped) {
+    dst.groups.emplace_back(0);
+  }
 
-template<class InputIt>
-ifstream::off_type find_file_offset(const RvaAndSize& dst, InputIt first, InputIt last) {
-  auto found = find_if(first, last, [&dst] (auto& entry) { 
-    return entry.rva <= dst.rva && dst.rva + dst.sz < entry.rva + entry.sz_virt; });
+  auto& members = settings.grouped ? dst.groups[0].members : dst.members;
 
-  return found != last ? 
-    found->file_offset + dst.rva - found->rva
-      : -1;
-}
+  type_ref_resolver resolver(meta);
+  type_def_resolver typeDefs(meta);
+  signature_decoder signatures(meta, resolver, typeDefs);
+  attribute_decoder decoder(meta, resolver, typeDefs, signatures);
+  custom_attributes attributes(meta);
+
+  string text;
+  vector<dword> applied;
+
+  // Lists the attributes of a HasCustomAttribute parent, false once over budget.
+  auto add = [&] (dword parent, const string& name) {
+    applied.clear();
+
+    attributes.for_each(parent, [&] (dword row) {
+      CustomAttributeTable attribute;
+      meta.read_row(row, attribute);
+
+      text.clear();
+      if (!decoder.type(attribute.type, text)) {
+        return;
+      }
 
-template<class InputIt>
-bool try_find_file_offset(const RvaAndSize& dst, InputIt first, InputIt last, ifstream::off_type& out_offset) {
-  auto found = find_if(first, last, [&dst] (auto& entry) { 
-    return entry.rva <= dst.rva && dst.rva + dst.sz < entry.rva + entry.sz_virt; });
+      if (settings.attribute_args && (*settings.attribute_args)(text)
+          && !decoder.arguments(attribute.type, attribute.value, text)) {
+        text.append("(?)");
+      }
+
+      applied.push_back(strings.intern(text));
+    });
+
+    if (applied.empty()) {
+      return true;
+    }
+
+    if (!budget.charge(applied.size() * sizeof(dword) + sizeof(type_refs_list::value_type))) {
+      return false;
+    }
 
-  if (found != last) {
-    out_offset = found->file_offset + dst.rva - found->rva;
+    auto type = strings.intern(name);
+    if (settings.grouped) {
+      dst.groups[0].types.push_back(type);
+    } else {
+      dst.refs.push_back(make_pair(dword(0), type));
+    }
+    members.push_back(applied);
     return true;
+  };
+
+  if (meta.rows_count(TableFlag::Assembly)
+      && !add(coded_index<HasCustomAttribute>::encode(HasCustomAttribute::Assembly, 0), "<Assembly>")) {
+    return;
   }
 
-  return false;
-}
+  // The first row is the <Module> pseudo type holding global members.
+  for (dword i = 1; i < typeDefsCount; ++i) {
+    if (!budget.tick()) {
+      return;
+    }
 
+    if (!add(coded_index<HasCustomAttribute>::encode(HasCustomAttribute::TypeDef, i), typeDefs.resolve(i))) {
+      return;
+    }
+  }
 
-inline dword get_table_size(const TablesMapping& mapping, const dword size[], TableFlag table) {
-  return size[mapping[static_cast<size_t>(table)]];
+  dst.diagnostics = resolver.diagnostics();
+  auto& more = typeDefs.diagnostics();
+  dst.diagnostics.insert(dst.diagnostics.end(), more.begin(), more.end());
 }
 
-inline size_t get_index_size_h(const MetadataHeader& hdr, HeapSizesFlags heap) {
-  return sizeof(word) << has_flag(hdr.heap_sizes, heap);
+
+/*
+
+  The manifest resources of an image, for its own assembly: embedded ones
+  with their size, the others with the file or the assembly they are in.
+  Looking for settings.extract_resource, only that one is listed and,
+  when embedded, its range is kept for the caller to copy out.
+
+*/
+static void collect_resources(const metadata& meta, const image_loader& image,
+    const image_mapping& mapping, const matchers_list& matchers,
+    const collect_settings& settings, string_interner& strings, file_budget& budget,
+    file_results& dst) {
+
+  // Most images have none, they make no records.
+  auto resourcesCount = meta.rows_count(TableFlag::ManifestResource);
+  if (!resourcesCount) {
+    return;
+  }
+
+  auto identity = own_identity(meta, strings);
+  if (!any_match(matchers, string(strings.get(identity.name)))) {
+    return;
+  }
+
+  embedded_resources embedded(image, mapping);
+  string text;
+
+  for (dword i = 0; i < resourcesCount; ++i) {
+    if (!budget.tick()) {
+      return;
+    }
+
+    ManifestResourceTable row;
+    meta.read_row(i, row);
+
+    auto name = meta.get_string(row.name);
+    if (settings.extract_resource && strcmp(name, settings.extract_resource)) {
+      continue;
+    }
+
+    text.assign(name).append(" (");
+
+    TableFlag table;
+    auto index = coded_index<Implementation>::decode(row.implementation, table);
+
+    resource_range range;
+    if (!row.implementation) {
+      if (!embedded.find(row.offset, range)) {
+        dst.diagnostics.push_back(string("Resource '") + name + "' is outside the resources directory");
+        continue;
+      }
+
+      text.append(to_string(range.size)).append(" bytes");
+    } else if (table == TableFlag::File) {
+      FileTable file;
+      meta.read_row(index, file);
+      text.append("in file ").append(meta.get_string(file.name));
+    } else if (table == TableFlag::AssemblyRef) {
+      AssemblyRefTable ref;
+      meta.read_row(index, ref);
+      text.append("in assembly ").append(meta.get_string(ref.name));
+    } else {
+      continue;   // ExportedType is not a place for resources
+    }
+
+    text.append(")");
+
+    if (!budget.charge(text.size() + sizeof(type_refs_list::value_type))) {
+      return;
+    }
+
+    if (dst.assemblies.empty()) {
+      dst.assemblies.push_back(identity);
+      if (settings.grouped) {
+        dst.groups.emplace_back(0);
+      }
+    }
+
+    auto resource = strings.intern(text);
+    if (settings.grouped) {
+      dst.groups[0].types.push_back(resource);
+    } else {
+      dst.refs.push_back(make_pair(dword(0), resource));
+    }
+
+    // Names are unique in a well-formed image, the first one is taken otherwise.
+    if (settings.extract_resource) {
+      dst.resource = range;
+      return;
+    }
+  }
 }
 
-#define TABLE_INDEX_FIELD_SIZE_ESTIMATE(rowsCount, shift) \
-  (sizeof(word) << ((rowsCount) >= ((dword(1) << (bitsizeof_(word) - (shift))) - 1)))
-inline size_t get_index_size_t(const TablesMapping& mapping, const dword size[], TableFlag table, int shift = 0) {
-  auto m = mapping[as_integral(table)];
-  return TABLE_INDEX_FIELD_SIZE_ESTIMATE(m != Unmapped ? size[m] : 0, shift);
+
+// Prefetches the parts of a mapped image the decoder is going to walk over.
+static void advise_metadata(const image_mapping& mapping, const image_loader& image, const metadata& meta) {
+  auto& tables = meta.tables_stream;
+  mapping.advise(image.meta_offset + tables.ofs, tables.sz, POSIX_MADV_WILLNEED);
+
+  if (auto stream = meta.find_stream("#Strings")) {
+    mapping.advise(image.meta_offset + stream->ofs, stream->sz, POSIX_MADV_WILLNEED);
+  }
 }
 
-template<class TCol>
-struct coded_index {
+static bool process_image(const image_loader& image, const image_mapping* mapping,
+    const matchers_list& matchers, const collect_settings& settings, string_interner& strings,
+    file_budget& budget, file_results& dst) {
+
+  dst.kind = image.triage.kind;
 
-  static constexpr dword mask = ~(dword(-1) << TCol::shift);
+  if (image.current() == image_loader::stage::over_budget) {
+    dst.over_budget = image.error();
+    return false;
+  }
 
-  static constexpr dword decode(dword value, TableFlag& out_flag) {
-    out_flag = TCol::m[(value & mask)];
-    return (value >> TCol::shift) - 1;
+  if (image.current() != image_loader::stage::done) {
+    dst.skipped = image.current() == image_loader::stage::skipped;
+    dst.error = image.error();
+    return false;
   }
 
-  static constexpr size_t get_size(const TablesMapping& mapping, const dword size[]) {
-    size_t result = 0;
+  if (!image.meta_data) {
+    return true; // triage only
+  }
 
-    for (auto t : TCol::m) {
-      if (t != TableFlag::Undefined) {
-        result = max(result, get_index_size_t(mapping, size, t, TCol::shift));
-      }
+  budget.start();
+  if (!mapping) {
+    budget.charge(image.meta_size);
+  }
+
+  metadata meta;
+  if (auto error = read_metadata(image.meta_data, image.meta_size, meta, budget)) {
+    if (budget.exceeded()) {
+      dst.over_budget = budget.exceeded();
+    } else {
+      dst.error = error;
+    }
+    return false;
+  }
+
+  if (mapping) {
+    advise_metadata(*mapping, image, meta);
+  }
+
+  if (settings.defined) {
+    collect_defined_types(meta, matchers, settings, strings, budget, dst);
+  } else if (settings.instantiations) {
+    collect_instantiations(meta, matchers, settings, strings, budget, dst);
+  } else if (settings.pinvoke) {
+    collect_pinvokes(meta, matchers, settings, strings, budget, dst);
+  } else if (settings.calls && mapping) {
+    collect_call_sites(meta, image, *mapping, matchers, settings, strings, budget, dst);
+  } else if (settings.strings) {
+    collect_user_strings(meta, matchers, settings, strings, budget, dst);
+  } else if (settings.attributes) {
+    collect_attributes(meta, matchers, settings, strings, budget, dst);
+  } else if (settings.resources && mapping) {
+    collect_resources(meta, image, *mapping, matchers, settings, strings, budget, dst);
+  } else {
+    collect_type_refs(meta, matchers, settings, strings, budget, dst);
+  }
+
+  // Partial results of a file over its budget are dropped.
+  if (budget.exceeded()) {
+    dst.over_budget = budget.exceeded();
+    dst.assemblies.clear();
+    dst.refs.clear();
+    dst.groups.clear();
+    dst.members.clear();
+    dst.diagnostics.clear();
+    dst.resource = {};
+    return false;
+  }
+
+  return true;
+}
+
+
+static void write_json_string(ostream& out, string_view s) {
+  out << '"';
+  for (auto c : s) {
+    switch (c) {
+      case '"':  out << "\\\""; break;
+      case '\\': out << "\\\\"; break;
+      default:
+        if (static_cast<unsigned char>(c) < 0x20) {
+          out << "\\u" << hex << setw(4) << setfill('0') << int(c) << dec << setfill(' ');
+        } else {
+          out << c;
+        }
+    }
+  }
+  out << '"';
+}
+
+/*
+
+  Output records are either elements of one JSON array or, with --ndjson,
+  one object per line so that consumers can start before the run ends.
+
+*/
+struct record_sink {
+  ostream& out;
+  bool lines = false;
+  const char* sep = "";
+
+  record_sink(ostream& out, bool lines)
+    : out(out), lines(lines) {}
+
+  void begin() {
+    if (!lines) {
+      out << sep;
+    }
+    out << "{";
+  }
+
+  void end() {
+    out << "}";
+    if (lines) {
+      out << '\n';
     }
+    sep = ",";
+  }
 
-    return result;
+  void open() {
+    if (!lines) {
+      out << "[";
+    }
   }
 
-  coded_index() = delete;
+  void close() {
+    if (!lines) {
+      out << "]" << endl;
+    }
+  }
 };
 
+static void write_file_field(record_sink& sink, const char* file) {
+  if (file) {
+    sink.out << "\"file\":";
+    write_json_string(sink.out, file);
+    sink.out << ",";
+  }
+}
+
+static void write_skipped(record_sink& sink, const char* reason, const char* file) {
+  sink.begin();
+  write_file_field(sink, file);
+  sink.out << "\"skipped\":";
+  write_json_string(sink.out, reason);
+  sink.end();
+}
 
-static void get_string(istream& src, ifstream::off_type base, dword index, string& output) {
-  auto ofs = src.tellg();
+static void write_triage(record_sink& sink, const file_results& results, const char* file) {
+  sink.begin();
+  write_file_field(sink, file);
+  sink.out << "\"kind\":\"" << to_string(results.kind) << "\"";
+  if (results.error) {
+    sink.out << ",\"reason\":";
+    write_json_string(sink.out, results.error);
+  }
+  sink.end();
+}
 
-  src.seekg(base + index, istream::beg);
-  getline(src, output, '\0');
-  src.seekg(ofs, istream::beg);
+// The "assembly" field and the rest of the identity, AssemblyName style.
+static void write_assembly_fields(ostream& out, const assembly_identity& assembly,
+    const string_interner& strings) {
+
+  auto culture = strings.get(assembly.culture);
+  auto token = strings.get(assembly.token);
+
+  out << "\"assembly\":";
+  write_json_string(out, strings.get(assembly.name));
+  out << ",\"version\":\"" << assembly.version_string() << "\"";
+  out << ",\"culture\":";
+  write_json_string(out, culture.empty() ? "neutral" : culture);
+  out << ",\"publicKeyToken\":";
+  if (token.empty()) {
+    out << "null";
+  } else {
+    write_json_string(out, token);
+  }
 }
 
-static void get_guid(istream& src, ifstream::off_type base, dword index, guid& output) {
-  auto ofs = src.tellg();
+static void write_members(ostream& out, const vector<dword>& members, const string_interner& strings) {
+  out << "\"members\":[";
 
-  src.seekg(base + (index - 1) * sizeof(guid), istream::beg);
-  src.read(reinterpret_cast<char*>(&output), sizeof(guid));
-  src.seekg(ofs, istream::beg);
+  auto sep = "";
+  for (auto name : members) {
+    out << sep;
+    write_json_string(out, strings.get(name));
+    sep = ",";
+  }
+
+  out << "]";
 }
 
+static void write_type_refs(record_sink& sink, const file_results& results,
+    const string_interner& strings, bool grouped, const char* file) {
 
-class matcher {
-public:
-  virtual ~matcher() {}
+  auto& out = sink.out;
 
-  virtual bool operator()(const string& s) const = 0;
-};
+  if (grouped) {
+    auto& groups = results.groups;
+    auto identity = [&] (size_t group) -> const assembly_identity& {
+      return results.assemblies[groups[group].assembly];
+    };
 
-struct matcher_any : public matcher {
-  bool operator()(const string& s) const override {
-    return true;
+    // Groups are ordered by identity only here, rows sharing one make one record.
+    vector<size_t> order(groups.size());
+    iota(order.begin(), order.end(), 0);
+    stable_sort(order.begin(), order.end(), [&] (size_t a, size_t b) {
+      auto& x = identity(a);
+      auto& y = identity(b);
+      return make_tuple(strings.get(x.name), x.version, strings.get(x.culture), strings.get(x.token))
+        < make_tuple(strings.get(y.name), y.version, strings.get(y.culture), strings.get(y.token));
+    });
+
+    for (size_t i = 0; i < order.size();) {
+      auto& assembly = identity(order[i]);
+
+      sink.begin();
+      write_file_field(sink, file);
+      write_assembly_fields(out, assembly, strings);
+      out << ",\"types\":[";
+
+      auto sep1 = "";
+      for (; i < order.size() && identity(order[i]) == assembly; ++i) {
+        auto& group = groups[order[i]];
+
+        // With --members every type becomes an object holding them.
+        for (size_t j = 0; j < group.types.size(); ++j) {
+          out << sep1;
+          if (group.members.empty()) {
+            write_json_string(out, strings.get(group.types[j]));
+          } else {
+            out << "{\"type\":";
+            write_json_string(out, strings.get(group.types[j]));
+            out << ",";
+            write_members(out, group.members[j], strings);
+            out << "}";
+          }
+
+          sep1 = ",";
+        }
+      }
+
+      out << "]";
+      sink.end();
+    }
   }
-};
+  else {
+    for (size_t i = 0; i < results.refs.size(); ++i) {
+      auto& p = results.refs[i];
+
+      sink.begin();
+      write_file_field(sink, file);
+      write_assembly_fields(out, results.assemblies[p.first], strings);
+      out << ",\"type\":";
+      write_json_string(out, strings.get(p.second));
+      if (!results.members.empty()) {
+        out << ",";
+        write_members(out, results.members[i], strings);
+      }
+      sink.end();
+    }
+  }
+}
 
-struct matcher_text : public matcher {
-  regex _re;
+// Records of one batch file, its problems go to err prefixed with the path.
+static void write_file_results(record_sink& sink, ostream& err, const string& path,
+    const file_results& results, const string_interner& strings, bool grouped, bool triageOnly) {
 
-  matcher_text(const string& text)
-    : _re(text) { }
+  if (triageOnly) {
+    return write_triage(sink, results, path.c_str());
+  }
 
-  bool operator()(const string& s) const override {
-    return regex_match(s, _re);
+  if (results.over_budget) {
+    return write_skipped(sink, results.over_budget, path.c_str());
+  }
+
+  if (results.error) {
+    if (!results.skipped) {
+      err << "'" << path << "': " << results.error << endl;
+    }
+
+    return;
+  }
+
+  for (auto& diagnostic : results.diagnostics) {
+    err << "'" << path << "': " << diagnostic << endl;
+  }
+
+  write_type_refs(sink, results, strings, grouped, path.c_str());
+}
+
+// Same as write_file_results(), only into the binary format.
+static void add_file_results(refs_writer& writer, ostream& err, const string& path,
+    const file_results& results, const string_interner& strings, bool triageOnly) {
+
+  const char* note = results.over_budget ? results.over_budget
+    : results.error ? results.error : "";
+
+  auto file = writer.add_file(path, to_string(results.kind), note);
+
+  if (results.error && !results.skipped && !triageOnly) {
+    err << "'" << path << "': " << results.error << endl;
+  }
+
+  for (auto& diagnostic : results.diagnostics) {
+    err << "'" << path << "': " << diagnostic << endl;
   }
-};
+
+  vector<uint32_t> assemblies;
+  for (auto& a : results.assemblies) {
+    assemblies.push_back(writer.add_assembly(strings.get(a.name), a.version_string(),
+      strings.get(a.culture), strings.get(a.token)));
+  }
+
+  for (size_t i = 0; i < results.refs.size(); ++i) {
+    auto& p = results.refs[i];
+    auto ref = writer.add_ref(file, assemblies[p.first], strings.get(p.second));
+
+    if (!results.members.empty()) {
+      for (auto name : results.members[i]) {
+        writer.add_member(ref, strings.get(name));
+      }
+    }
+  }
+}
 
 
 #include "optionparser.h"
@@ -177,18 +1441,93 @@ struct Arg: public option::Arg
   }
 };
 
-enum  optionIndex { UNKNOWN, HELP, OUT_GROUP, RE_ASM };
+enum  optionIndex { UNKNOWN, HELP, OUT_GROUP, RE_ASM, JOBS, INFLIGHT, MMAP, TRIAGE, FILE_TIMEOUT, FILE_MEM_LIMIT, NDJSON, BINARY, DEDUPE, DEFINED_TYPES, MEMBERS, SIGNATURES, INSTANTIATIONS, PINVOKE, CALLS, STRINGS, ATTRIBUTES, ATTRIBUTE_ARGS, LIST_RESOURCES, EXTRACT_RESOURCE, EXTRACT_DIR };
 const option::Descriptor usage[] =
 {
- {UNKNOWN,   0, ""  , ""        ,option::Arg::None,  "USAGE: assembly [options] -- <path/to/assembly.dll>\n\n"
+ {UNKNOWN,   0, ""  , ""        ,option::Arg::None,  "USAGE: assembly [options] -- <path/to/assembly.dll|directory>...\n\n"
                                                      "Options:" },
  {HELP,      0, ""  , "help"    , option::Arg::None, "  --help         \tPrint usage and exit." },
- {OUT_GROUP, 0, "g" , "group"   , option::Arg::None, "  --group, -g    \tThe resulting JSON is grouped by assembly name." },
+ {OUT_GROUP, 0, "g" , "group"   , option::Arg::None, "  --group, -g    \tThe resulting JSON is grouped by assembly (name, version, culture, key)." },
  {RE_ASM,    0, "a" , "assembly", Arg::Required,     "  --assembly, -a \tAssemblies filter regexp." },
+ {JOBS,      0, "j" , "jobs"    , Arg::Numeric,      "  --jobs, -j     \tBatch mode: number of threads decoding loaded images." },
+ {INFLIGHT,  0, ""  , "inflight", Arg::Numeric,      "  --inflight     \tBatch mode: number of images being read at once." },
+ {MMAP,      0, ""  , "mmap"    , option::Arg::None, "  --mmap         \tMap images into memory instead of reading them." },
+ {TRIAGE,    0, ""  , "triage"  , option::Arg::None, "  --triage       \tOnly classify images: native, managed, r2r or corrupt." },
+ {FILE_TIMEOUT,   0, "", "file-timeout"  , Arg::Numeric, "  --file-timeout   \tMilliseconds a file may take to decode, it is skipped past that." },
+ {FILE_MEM_LIMIT, 0, "", "file-mem-limit", Arg::Numeric, "  --file-mem-limit \tMegabytes a file may take to decode, it is skipped past that." },
+ {NDJSON,    0, ""  , "ndjson"  , option::Arg::None, "  --ndjson       \tOne JSON object per line, batch results stream as files complete." },
+ {BINARY,    0, ""  , "binary"  , option::Arg::None, "  --binary       \tColumnar binary output with a string table, see refs_format.hpp." },
+ {DEDUPE,    0, ""  , "dedupe"  , option::Arg::None, "  --dedupe       \tReport a type once per assembly identity (name, key), whatever the version and culture." },
+ {DEFINED_TYPES, 0, "", "defined-types", option::Arg::None, "  --defined-types \tList the types images define instead of those they reference." },
+ {MEMBERS,   0, ""  , "members" , option::Arg::None, "  --members      \tList the members referenced on every type (MemberRef)." },
+ {SIGNATURES, 0, "" , "signatures", option::Arg::None, "  --signatures   \tWith --members, list them with their signatures: \"bool TryGetValue(!0,!1&)\"." },
+ {INSTANTIATIONS, 0, "", "instantiations", option::Arg::None, "  --instantiations \tList the generic instantiations images make (TypeSpec, MethodSpec) instead of the types." },
+ {PINVOKE,   0, ""  , "pinvoke" , option::Arg::None, "  --pinvoke      \tList the native modules images import from and their entry points (ImplMap)." },
+ {CALLS,     0, ""  , "calls"   , option::Arg::None, "  --calls        \tList the methods images define with what their IL calls, creates and loads. Implies --mmap." },
+ {STRINGS,   0, ""  , "strings" , option::Arg::None, "  --strings      \tList the string literals of images (#US) matching -a, with --calls by the methods loading them." },
+ {ATTRIBUTES, 0, "" , "attributes", option::Arg::None, "  --attributes   \tList the custom attributes of the types and assemblies images define." },
+ {ATTRIBUTE_ARGS, 0, "", "attribute-args", Arg::Required, "  --attribute-args \tDecode the arguments of the attributes whose type matches this regexp. Implies --attributes." },
+ {LIST_RESOURCES, 0, "", "list-resources", option::Arg::None, "  --list-resources \tList the manifest resources of images, embedded ones with their size. Implies --mmap." },
+ {EXTRACT_RESOURCE, 0, "", "extract-resource", Arg::Required, "  --extract-resource \tCopy out the embedded resource of this name: of a single image to stdout, else see --extract-dir." },
+ {EXTRACT_DIR, 0, "", "extract-dir", Arg::Required, "  --extract-dir  \tDirectory the extracted resources are written to, at the path of their image, which are then listed as well." },
 
  {0,0,0,0,0,0}
 };
 
+static constexpr size_t DEFAULT_INFLIGHT = 256;
+
+static size_t get_numeric_option(const option::Option& opt, size_t fallback) {
+  auto value = opt ? strtol(opt.last()->arg, nullptr, 10) : 0;
+  return value > 0 ? size_t(value) : fallback;
+}
+
+/*
+
+  Writes an extracted resource to dir/<absolute image path>/name, so that
+  images of the same file name do not overwrite each other's.
+
+*/
+static bool write_resource(const image_file& file, const resource_range& range, const string& path,
+    const char* name, const char* dir, string& error) {
+
+  error_code ec;
+  auto target = filesystem::path(dir) / filesystem::absolute(path, ec).lexically_normal().relative_path() / name;
+  filesystem::create_directories(target.parent_path(), ec);
+
+  auto fd = ::open(target.c_str(), O_WRONLY | O_CREAT | O_TRUNC | O_CLOEXEC, 0644);
+  if (fd < 0 || !copy_range(file.fd(), range.offset, range.size, fd)) {
+    error = "Cannot write '" + target.string() + "': " + strerror(errno);
+    if (fd >= 0) {
+      ::close(fd);
+    }
+    return false;
+  }
+
+  ::close(fd);
+  return true;
+}
+
+// Directory scans pick up PE images only, explicitly listed files are always taken.
+static void collect_directory(const char* path, vector<string>& paths) {
+  auto first = paths.size();
+
+  error_code ec;
+  for (filesystem::recursive_directory_iterator it(path, ec), end; !ec && it != end; it.increment(ec)) {
+    if (!it->is_regular_file(ec)) {
+      continue;
+    }
+
+    auto ext = it->path().extension().string();
+    transform(ext.begin(), ext.end(), ext.begin(), ::tolower);
+
+    if (ext == ".dll" || ext == ".exe") {
+      paths.push_back(it->path().string());
+    }
+  }
+
+  sort(paths.begin() + first, paths.end());
+}
+
 
 int main(int argc, const char *argv[]) {
   argc-=(argc>0); argv+=(argc>0); // skip program name argv[0] if present
@@ -227,395 +1566,243 @@ int main(int argc, const char *argv[]) {
     }
   }
 
-  ifstream assembly;
+  vector<string> paths;
+  bool batch = parse.nonOptionsCount() > 1;
   {
-    if (parse.nonOptionsCount() != 1) {
+    if (parse.nonOptionsCount() < 1) {
       cerr << "Assembly file not specified" << endl;
       option::printUsage(cerr, usage);
       return 2;    
     }
 
-    auto filePath = parse.nonOption(0);
+    for (int i = 0; i < parse.nonOptionsCount(); ++i) {
+      auto filePath = parse.nonOption(i);
 
-    assembly.open(filePath, ifstream::binary);
-    if (!assembly)
-    {
-      cerr << "Cannot open '" << filePath << "'" << endl;
-      return -2;
+      error_code ec;
+      if (filesystem::is_directory(filePath, ec)) {
+        collect_directory(filePath, paths);
+        batch = true;
+      }
+      else {
+        paths.push_back(filePath);
+      }
     }
   }
 
   cout << boolalpha;
 
-  HDR_MSDOS hdrMsDos;
-  assembly.read(reinterpret_cast<char*>(&hdrMsDos), sizeof(hdrMsDos));
-  assembly.seekg(hdrMsDos.e_lfanew, assembly.beg);
+  const bool ndjson = options[NDJSON] != nullptr;
+  const bool binary = options[BINARY] != nullptr;
 
-  HDR_COFF hdrCoff;
-  assembly.read(reinterpret_cast<char*>(&hdrCoff), sizeof(hdrCoff));
-  assembly.seekg(sizeof(HDR_COFF_STD), assembly.cur);
+  const bool grouped = options[OUT_GROUP] != nullptr;
 
-  HDR_COFF_WIN hdrCoffWin;
-  assembly.read(reinterpret_cast<char*>(&hdrCoffWin), sizeof(hdrCoffWin));
+  unique_ptr<matcher> attributeArgs;
+  if (options[ATTRIBUTE_ARGS]) {
+    auto opt = options[ATTRIBUTE_ARGS].last();
+    try {
+      attributeArgs = make_unique<matcher_text>(opt->arg);
+    }
+    catch (regex_error&) {
+      cerr << "'" << opt->arg << "' regex is ill-formed." << endl;
+      return -1;
+    }
+  }
 
-  DIAGNOSTICS(
-    cout << "Image Base:" << endl;
-    cout << "  " << hdrCoffWin.image_base << endl;
-    cout << endl;
-  );
+  const collect_settings collect = {
+    grouped,
+    options[DEDUPE] != nullptr,
+    options[DEFINED_TYPES] != nullptr,
+    options[MEMBERS] != nullptr,
+    options[SIGNATURES] != nullptr,
+    options[INSTANTIATIONS] != nullptr,
+    options[PINVOKE] != nullptr,
+    options[CALLS] != nullptr,
+    options[STRINGS] != nullptr,
+    options[ATTRIBUTES] != nullptr || attributeArgs,
+    attributeArgs.get(),
+    options[LIST_RESOURCES] || options[EXTRACT_RESOURCE],
+    options[EXTRACT_RESOURCE] ? options[EXTRACT_RESOURCE].last()->arg : nullptr,
+  };
 
-  vector<DataDirsEntry> dataDirs(hdrCoffWin.num_data_dirs);
-  for (auto& entry : dataDirs) {
-    assembly.read(reinterpret_cast<char*>(&entry), sizeof(entry));
+  const char* extractDir = options[EXTRACT_DIR] ? options[EXTRACT_DIR].last()->arg : nullptr;
+  if (collect.extract_resource && batch && !extractDir) {
+    cerr << "--extract-resource of several images needs --extract-dir" << endl;
+    return 1;
   }
 
-  auto& hdrCliEntry = dataDirs[14];
-
-  DIAGNOSTICS(
-    cout << "CLI header meta:" << endl;
-    cout << "  size: " << hdrCliEntry.sz  << endl;
-    cout << "  rva:  " << hdrCliEntry.rva << endl;
-    cout << endl;
-  );
+  // Each run lists one kind of thing; --strings with --calls narrows the call sites.
+  int modes = collect.defined + collect.instantiations + collect.pinvoke + collect.calls
+    + (collect.strings && !collect.calls) + collect.attributes + collect.resources;
+  if (modes > 1) {
+    cerr << "--defined-types, --instantiations, --pinvoke, --calls, --strings, --attributes"
+      " and --list-resources are exclusive" << endl;
+    return 1;
+  }
 
-  vector<SectionHeadersEntry> sectionHeaders(hdrCoff.num_sections);
-  {
-    for (auto& entry : sectionHeaders) {
-      assembly.read(reinterpret_cast<char*>(&entry), sizeof(entry));
+  if (ndjson && binary) {
+    cerr << "--ndjson and --binary are exclusive" << endl;
+    return 1;
+  }
 
-      DIAGNOSTICS(
-        cout << entry.name << " section:" << endl;
-        cout << "  V. size:  " << entry.sz_virt  << endl;
-        cout << "  V. addr:  " << entry.rva << endl;
-        cout << "  Raw size: " << entry.sz_raw   << endl;
-        cout << "  Raw addr: " << entry.file_offset  << endl;
-        cout << endl;
-      );
-    }
+  // The binary columns are not grouped, consumers query them as they like.
+  if (grouped && binary) {
+    cerr << "--group and --binary are exclusive" << endl;
+    return 1;
   }
 
-  auto hdrCliHeaderOfs = find_file_offset(hdrCliEntry,
-    sectionHeaders.begin(), sectionHeaders.end());
+  // Method bodies and resources are outside the metadata, they are only read from a mapping.
+  const bool mapped = options[MMAP] != nullptr || options[CALLS] != nullptr || collect.resources;
+  const bool triageOnly = options[TRIAGE] != nullptr;
 
-  assert(hdrCliHeaderOfs >= 0);
-  assembly.seekg(hdrCliHeaderOfs, assembly.beg);
+  const file_budget budget(
+    chrono::milliseconds(get_numeric_option(options[FILE_TIMEOUT], 0)),
+    get_numeric_option(options[FILE_MEM_LIMIT], 0) << 20);
 
-  HDR_CLI hdrCli;
-  assembly.read(reinterpret_cast<char*>(&hdrCli), sizeof(hdrCli));
+  // Shared by the batch workers, names recurring across files are kept once.
+  string_interner strings;
 
-  DIAGNOSTICS(
-    cout << "CLI header:" << endl;
-    cout << "  size: " << hdrCli.sz << endl;
-    cout << "  ver.: " << hdrCli.rt_major << "." << hdrCli.rt_minor << endl;
-    cout << endl;
-  );
+  if (!batch && !triageOnly) {
+    auto filePath = paths[0].c_str();
 
-  auto rootMetaOfs = find_file_offset(hdrCli.meta,
-    sectionHeaders.begin(), sectionHeaders.end());
+    image_file assembly;
+    if (!assembly.open(filePath))
+    {
+      cerr << "Cannot open '" << filePath << "'" << endl;
+      return -2;
+    }
 
-  assert(rootMetaOfs >= 0);
-  assembly.seekg(rootMetaOfs, assembly.beg);
+    image_mapping mapping;
+    if (mapped && !mapping.map(assembly)) {
+      cerr << "Cannot map '" << filePath << "'" << endl;
+      return -2;
+    }
 
-  MetadataRoot rootMeta;
-  assembly.read(reinterpret_cast<char*>(&rootMeta), sizeof(rootMeta));
+    image_loader image;
+    image.mem_limit(budget.mem_limit());
 
-  string cliVersion(rootMeta.sz_version, 0);
-  assembly.read(&cliVersion[0], cliVersion.size());
-  assembly.seekg(round_up(4, rootMeta.sz_version)
-    + sizeof(word) - rootMeta.sz_version, assembly.cur);
+    if (mapped) {
+      load_image(mapping, image);
+    } else {
+      image.file_size(assembly.size());
+      load_image(assembly, image);
+    }
 
-  map<string, StreamHeader> streamHeaders;
-  {
-    word numStreams;
-    assembly.read(reinterpret_cast<char*>(&numStreams), sizeof(numStreams));
+    file_results results;
+    auto fileBudget = budget;
+    if (!process_image(image, mapped ? &mapping : nullptr, matchers, collect, strings, fileBudget, results)
+        && !results.over_budget) {
+      cerr << results.error << endl;
+      return -3;
+    }
 
-    DIAGNOSTICS(
-      cout << "Metadata root [0x" << hex
-        << rootMetaOfs << dec << "]:" << endl;
-      cout << "  signature:     " << hex << showbase 
-        << rootMeta.sig << dec << endl;
-      cout << "  version:       " << cliVersion << endl;
-      cout << "  streams count: " << numStreams << endl;
-      cout << endl;
-    );
+    // Without a directory the resource itself is the output.
+    if (collect.extract_resource && !extractDir) {
+      for (auto& diagnostic : results.diagnostics) {
+        cerr << diagnostic << endl;
+      }
 
-    StreamHeader entry;
-    string streamName;
-    for (; numStreams > 0; --numStreams) {
-      assembly.read(reinterpret_cast<char*>(&entry), sizeof(entry));
-      getline(assembly, streamName, '\0');
-      ignore_all(assembly, 4);
+      if (results.resource.offset < 0) {
+        cerr << "Resource '" << collect.extract_resource << "' is not embedded in '" << filePath << "'" << endl;
+        return -4;
+      }
 
-      streamHeaders[streamName] = entry;
+      if (!copy_range(assembly.fd(), results.resource.offset, results.resource.size, STDOUT_FILENO)) {
+        cerr << "Cannot write resource: " << strerror(errno) << endl;
+        return -4;
+      }
 
-      DIAGNOSTICS(
-        cout << streamName << " stream:" << endl;
-        cout << "  size:   " << entry.sz << endl;
-        cout << "  offset: " << entry.ofs << endl;
-        cout << endl;
-      );
+      return 0;
     }
-  }
-
-  auto& streamHdrTilda = streamHeaders["#~"];
-
-  MetadataHeader hdrMeta;
-  {
-    auto tildaHeaderOfs = rootMetaOfs + streamHdrTilda.ofs;
-
-    assembly.seekg(tildaHeaderOfs, assembly.beg);
-    assembly.read(reinterpret_cast<char*>(&hdrMeta), sizeof(hdrMeta));
-
-    DIAGNOSTICS(
-      cout << "Metadata header:" << endl;
-      cout << "  version:         " << static_cast<int>(hdrMeta.ver_major) << "."
-        << static_cast<int>(hdrMeta.ver_minor) << endl;
-      cout << "  heap size flags: " << hex << showbase << static_cast<int>(hdrMeta.heap_sizes)
-        << dec << endl;
-      cout << "  reserve:         " << static_cast<int>(hdrMeta.reserved) << endl;
-      cout << "  valid:           " << bitset<64>(hdrMeta.valid) << endl;
-      cout << "  sorted:          " << bitset<64>(hdrMeta.sorted) << endl;
-      cout << "  has TypeRef?:    " << is_bit_set(hdrMeta.valid,
-        as_integral(TableFlag::TypeRef)) << endl;
-      cout << endl;
-    );
-  }
-
-  TablesMapping tablesMapping;
-  fill(tablesMapping, tablesMapping + countof_(tablesMapping), Unmapped);
-
-  dword tableSizes[ones(hdrMeta.valid)];
-  assembly.read(reinterpret_cast<char*>(&tableSizes), sizeof(tableSizes));
-  {
-    auto ctl = hdrMeta.valid;
-    for(size_t i = 0, j = 0; ctl; ctl >>= 1, ++j) {
-      if (ctl & 1) {
-        tablesMapping[j] = i++;
-      }
-    }
-  }
-
-  IndexSize indexSize = {
-    { // heap
-      get_index_size_h(hdrMeta, HeapSizesFlags::Blob),
-      get_index_size_h(hdrMeta, HeapSizesFlags::Guid),
-      get_index_size_h(hdrMeta, HeapSizesFlags::String),
-    },
-    { // coded_cols
-      coded_index<CustomAttributeType> ::get_size(tablesMapping, tableSizes),
-      coded_index<HasConstant>         ::get_size(tablesMapping, tableSizes),
-      coded_index<HasCustomAttribute>  ::get_size(tablesMapping, tableSizes),
-      coded_index<HasDeclSecurity>     ::get_size(tablesMapping, tableSizes),
-      coded_index<HasFieldMarshal>     ::get_size(tablesMapping, tableSizes),
-      coded_index<HasSemantics>        ::get_size(tablesMapping, tableSizes),
-      coded_index<Implementation>      ::get_size(tablesMapping, tableSizes),
-      coded_index<MemberForwarded>     ::get_size(tablesMapping, tableSizes),
-      coded_index<MemberRefParent>     ::get_size(tablesMapping, tableSizes),
-      coded_index<MethodDefOrRef>      ::get_size(tablesMapping, tableSizes),
-      coded_index<ResolutionScope>     ::get_size(tablesMapping, tableSizes),
-      coded_index<TypeDefOrRef>        ::get_size(tablesMapping, tableSizes),
-      coded_index<TypeOrMethodDef>     ::get_size(tablesMapping, tableSizes),
-    },
-  };
-  
-  for (size_t i = 0; i < countof_(tablesMapping); ++i) {
-    auto t = tablesMapping[i];
-    indexSize.plain_cols.m[i] = TABLE_INDEX_FIELD_SIZE_ESTIMATE(
-      t != Unmapped ? tableSizes[t] : 0, 0);
-  }
-
-  DIAGNOSTICS(
-    stringstream tables;
-    tables << "table (" << ones(hdrMeta.valid) << ")";
-    cout << setw(25) << left  << tables.str();
-    cout << setw(8)  << right << "rows";
-    cout << setw(8)  << right << "size";
-    cout << setw(10) << right << "offset";
-    cout << endl;
-  );
-
-  const ifstream::off_type tablesOffset = assembly.tellg();
-  ifstream::off_type tableOffsets[ones(hdrMeta.valid)];
-  {
-    auto cumulativeOffset = tablesOffset;
-    for (size_t i = 0; i < countof_(tablesMapping); ++i) {
-      auto t = tablesMapping[i];
 
-      if (t != Unmapped) {
-        const auto tableRowsCount = tableSizes[t];
-        const auto tableFlag = TableFlag(i);
-        const auto tableSize = get_table_row_size(indexSize, tableFlag);
+    string error;
+    if (extractDir && results.resource.offset >= 0
+        && !write_resource(assembly, results.resource, paths[0], collect.extract_resource, extractDir, error)) {
+      results.diagnostics.push_back(error);
+    }
 
-        tableOffsets[t] = cumulativeOffset;
+    if (binary) {
+      refs_writer writer;
+      add_file_results(writer, cerr, paths[0], results, strings, false);
+      writer.write(cout);
+      return 0;
+    }
 
-        DIAGNOSTICS(
-          cout << setfill('.') << setw(25) << left << tableFlag;
-          cout << setw(8) << internal << tableRowsCount;
-          cout << setw(8) << internal << tableSize;
-          cout << setw(10) << setfill('\0') << right
-            << hex << showbase << cumulativeOffset << dec;
-          cout << endl;
-        );
+    for (auto& diagnostic : results.diagnostics) {
+      cerr << diagnostic << endl;
+    }
 
-        cumulativeOffset += tableRowsCount * tableSize;
-      }
+    record_sink sink(cout, ndjson);
+    sink.open();
+    if (results.over_budget) {
+      write_skipped(sink, results.over_budget, nullptr);
+    } else {
+      write_type_refs(sink, results, strings, grouped, nullptr);
     }
-  }
+    sink.close();
 
-  DIAGNOSTICS(
-    cout << endl;
-  );
+    return 0;
+  }
 
-  auto& streamHdrStrings = streamHeaders["#Strings"];
-  auto& streamHdrGuid    = streamHeaders["#GUID"];
+  // Extracted in the workers, while their image file is still open.
+  auto extract = [&] (const batch_item& item, file_results& results) {
+    string error;
+    if (extractDir && results.resource.offset >= 0
+        && !write_resource(item.file, results.resource, paths[item.index], collect.extract_resource, extractDir, error)) {
+      results.diagnostics.push_back(error);
+    }
+  };
 
-  string s;
+  batch_settings settings = {
+    get_numeric_option(options[INFLIGHT], DEFAULT_INFLIGHT),
+    get_numeric_option(options[JOBS], max(1u, thread::hardware_concurrency())),
+    mapped,
+    triageOnly,
+    budget,
+  };
 
-  vector<pair<string, string>> results;
-  {
-    auto m = tablesMapping[as_integral(TableFlag::TypeRef)];
-    size_t typeRefsCount = tableSizes[m];
+  // NDJSON records are formatted by the workers and stream out in input order.
+  if (ndjson) {
+    ordered_output output(paths.size(), cout, cerr);
 
-    struct call_context {
-      ifstream::off_type offset;
-      TableFlag table;
-    };
+    run_batch(paths, settings, [&] (batch_item& item) {
+      file_results results;
+      process_image(item.loader, mapped ? &item.mapping : nullptr,
+        matchers, collect, strings, item.budget, results);
+      extract(item, results);
 
-    stack<call_context> call_stack;
-    vector<string> name_parts;
-    TableFlag table_decoded = TableFlag::MemberRef;
+      stringstream out, err;
+      record_sink sink(out, true);
+      write_file_results(sink, err, paths[item.index], results, strings, grouped, triageOnly);
 
-    call_stack.push({
-      tableOffsets[m],
-      TableFlag::TypeRef,
+      output.complete(item.index, out.str(), err.str());
     });
 
-    while (call_stack.size() > 0) {
-      auto& ctx = call_stack.top();
-
-      assembly.seekg(ctx.offset, assembly.beg);
-
-      switch (ctx.table) {
-        case TableFlag::Module:
-        case TableFlag::ModuleRef:
-          // TODO: both are skipped for now.
-          name_parts.clear();
-          break;
-        case TableFlag::AssemblyRef: {
-          AssemblyRefTable table;
-          {
-            AssemblyRefTable::meta meta(indexSize);
-
-            char data[meta.row_size()];
-            assembly.read(data, sizeof(data));
-            meta.from_bytes(data, table);
-          }
-
-          if (name_parts.size()) {
-            string type_name = name_parts.back();
-            name_parts.pop_back();
-
-            for (auto it = name_parts.rbegin();
-                it != name_parts.rend();) {
-              type_name = *it++ + "." + type_name;
-            }
-
-            name_parts.clear();
-
-            get_string(assembly, rootMetaOfs + streamHdrStrings.ofs, table.name, s);
-            for (auto& m : matchers) {
-              if ((*m)(s)) {
-                results.push_back(make_pair(s, type_name));
-                break;
-              }
-            }
-          }
-          break;
-        }
-        case TableFlag::TypeRef: {
-          TypeRefTable table;
-          {
-            TypeRefTable::meta meta(indexSize);
-
-            char data[meta.row_size()];
-            assembly.read(data, sizeof(data));
-            meta.from_bytes(data, table);
-
-            if (call_stack.size() == 1
-                && --typeRefsCount) {
-              ctx.offset += meta.row_size();
-            } else {
-              call_stack.pop();
-            }
-          }
-
-          if (table.type_namespace != 0) {
-            get_string(assembly, rootMetaOfs + streamHdrStrings.ofs, table.type_namespace, s);
-            name_parts.push_back(s);
-          }
-
-          get_string(assembly, rootMetaOfs + streamHdrStrings.ofs, table.type_name, s);
-          name_parts.push_back(s);   
-
-          auto idx = coded_index<ResolutionScope>::decode(
-            table.resolution_scope, table_decoded);
-
-          call_stack.push({ 
-            ifstream::off_type(tableOffsets[tablesMapping[as_integral(table_decoded)]] + idx
-              * get_table_row_size(indexSize, table_decoded)),
-            table_decoded
-          });
-
-          continue;
-        }
-      }
-
-      call_stack.pop();
-    }
+    return 0;
   }
 
-  cout << "[";
-  if (results.size()) {
-    auto sep = "";
-    if (options[OUT_GROUP] != nullptr) {
-      map<string, vector<string>> grouping;
-      for(auto& p : results) {
-        grouping[p.first].push_back(p.second);
-      }
-
-      for(auto& g : grouping) {
-        cout << sep;
-        cout << "{"
-             << "\"assembly\":\"" << g.first << "\","
-             << "\"types\":[";
-
-        auto sep1 = "";
-        for (auto& s : g.second) {
-          cout << sep1;
-          cout << "\"" << s << "\"";
-
-          sep1 = ",";
-        }
+  vector<file_results> results(paths.size());
 
-        cout << "]}";
-
-        sep = ",";
-      }
-    }
-    else {
-      for(auto& p : results) {
-        cout << sep;
-        cout << "{"
-             << "\"assembly\":\"" << p.first  << "\","
-             << "\"type\":\""     << p.second << "\""
-             << "}";\
+  run_batch(paths, settings, [&] (batch_item& item) {
+    process_image(item.loader, mapped ? &item.mapping : nullptr,
+      matchers, collect, strings, item.budget, results[item.index]);
+    extract(item, results[item.index]);
+  });
 
-        sep = ",";
-      }
+  if (binary) {
+    refs_writer writer;
+    for (size_t i = 0; i < paths.size(); ++i) {
+      add_file_results(writer, cerr, paths[i], results[i], strings, triageOnly);
     }
+    writer.write(cout);
+    return 0;
   }
 
-  cout << "]" << endl;
+  record_sink sink(cout, false);
+  sink.open();
+  for (size_t i = 0; i < paths.size(); ++i) {
+    write_file_results(sink, cerr, paths[i], results[i], strings, grouped, triageOnly);
+  }
+  sink.close();
 
   return 0;
 }
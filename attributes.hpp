@@ -0,0 +1,501 @@
+#pragma once
+
+#ifndef ATTRIBUTES_HPP_
+#define ATTRIBUTES_HPP_
+
+#include <algorithm>
+#include <cstdio>
+#include <string>
+#include <string_view>
+#include <unordered_map>
+#include <utility>
+#include <vector>
+
+#include "declarations.hpp"
+#include "tables.hpp"
+#include "metadata.hpp"
+#include "resolver.hpp"
+#include "signatures.hpp"
+
+
+/*
+
+  CustomAttribute rows (II.22.10) by the entity they are applied to. The
+  table is to be sorted by its Parent column, as the header's sorted mask
+  tells, and the rows of one parent are then found by a binary search over
+  the table itself. Otherwise the rows are ordered by parent once, into an
+  index searched the same way.
+
+*/
+class custom_attributes {
+public:
+  explicit custom_attributes(const metadata& meta)
+    : _meta(meta), _sorted(meta.is_sorted(TableFlag::CustomAttribute)) {}
+
+  // Calls f(row) for the 0-based rows applied to parent, a HasCustomAttribute value.
+  template<class F>
+  void for_each(dword parent, F&& f) {
+    auto count = _meta.rows_count(TableFlag::CustomAttribute);
+
+    if (_sorted) {
+      CustomAttributeTable entry;
+      dword first = 0, last = count;
+      while (first < last) {
+        auto middle = first + (last - first) / 2;
+        _meta.read_row(middle, entry);
+
+        if (entry.parent < parent) {
+          first = middle + 1;
+        } else {
+          last = middle;
+        }
+      }
+
+      for (; first < count; ++first) {
+        _meta.read_row(first, entry);
+        if (entry.parent != parent) {
+          break;
+        }
+        f(first);
+      }
+
+      return;
+    }
+
+    if (_index.empty() && count) {
+      _index.reserve(count);
+      for (dword i = 0; i < count; ++i) {
+        CustomAttributeTable entry;
+        _meta.read_row(i, entry);
+        _index.emplace_back(entry.parent, i);
+      }
+      sort(_index.begin(), _index.end());
+    }
+
+    auto it = lower_bound(_index.begin(), _index.end(), std::make_pair(parent, dword(0)));
+    for (; it != _index.end() && it->first == parent; ++it) {
+      f(it->second);
+    }
+  }
+
+private:
+  const metadata& _meta;
+  bool _sorted;
+  std::vector<std::pair<dword, dword>> _index;  // parent and row, only when the table is not sorted
+};
+
+
+// Element types only custom attribute blobs use (II.23.3).
+enum class attribute_element : byte {
+  TYPE = 0x50,
+  BOXED = 0x51,
+  FIELD = 0x53,
+  PROPERTY = 0x54,
+  ENUM = 0x55,
+};
+
+static constexpr word ATTRIBUTE_PROLOG = 0x0001;
+
+/*
+
+  Renders custom attributes: the type their constructor belongs to and,
+  on demand, the fixed and named arguments of their value blobs, C#-like:
+
+    System.ObsoleteAttribute("Use Bar instead",true)
+    System.AttributeUsageAttribute(4,AllowMultiple=true)
+
+  Fixed arguments are typed by the constructor signature, named ones by
+  the blob. Enums show as their values. Their underlying type is only
+  known for enums the image defines, so the arguments of an attribute
+  with any other enum are not decoded: reading on from a guessed size
+  would garble everything after it.
+
+*/
+class attribute_decoder {
+public:
+  attribute_decoder(const metadata& meta, type_ref_resolver& typeRefs, type_def_resolver& typeDefs,
+      signature_decoder& signatures)
+    : _meta(meta), _type_refs(typeRefs), _type_defs(typeDefs), _signatures(signatures) {}
+
+  // Type of the constructor of a CustomAttribute row (its Type column), false if it cannot be named.
+  bool type(dword ctor, std::string& out) {
+    dword signature;
+    return constructor(ctor, out, signature);
+  }
+
+  // "(a,b,Name=c)" of a value blob, false if it is malformed; out is left as it was then.
+  bool arguments(dword ctor, dword value, std::string& out) {
+    std::string ignored;
+    dword signature;
+    if (!constructor(ctor, ignored, signature)) {
+      return false;
+    }
+
+    auto start = out.size();
+    blob_reader sig(_meta, signature);
+    blob_reader blob(_meta, value);
+
+    if (blob.read_value<word>() != ATTRIBUTE_PROLOG) {
+      return false;
+    }
+
+    sig.read_byte();
+    auto count = sig.read_compressed();
+    if (element_type(sig.read_byte()) != element_type::VOID) {
+      return false;
+    }
+
+    out.append("(");
+    auto sep = "";
+    for (dword i = 0; i < count && sig.ok() && blob.ok(); ++i) {
+      out.append(sep);
+      argument(blob, parameter_type(sig), out, 0);
+      sep = ",";
+    }
+
+    auto named = blob.read_value<word>();
+    for (dword i = 0; i < named && blob.ok(); ++i) {
+      auto kind = attribute_element(blob.read_byte());
+      if (kind != attribute_element::FIELD && kind != attribute_element::PROPERTY) {
+        blob.fail();
+        break;
+      }
+
+      auto valueType = serialized_type(blob);
+
+      std::string_view name;
+      blob.read_ser_string(name);
+
+      out.append(sep).append(name).append("=");
+      argument(blob, valueType, out, 0);
+      sep = ",";
+    }
+    out.append(")");
+
+    if (!sig.ok() || !blob.ok()) {
+      out.resize(start);
+      return false;
+    }
+
+    return true;
+  }
+
+private:
+  // Element type of a value and, for SZARRAY, that of its elements.
+  struct value_type {
+    byte kind = as_integral(element_type::END);
+    byte element = as_integral(element_type::END);
+  };
+
+  const metadata& _meta;
+  type_ref_resolver& _type_refs;
+  type_def_resolver& _type_defs;
+  signature_decoder& _signatures;
+
+  // Underlying types of the enums named in blobs so far.
+  std::unordered_map<std::string, byte> _serialized_enums;
+
+  static bool is_primitive(byte e) {
+    return e >= as_integral(element_type::BOOLEAN) && e <= as_integral(element_type::STRING);
+  }
+
+  // Name of the type declaring a constructor and the constructor's signature.
+  bool constructor(dword ctor, std::string& out, dword& signature) {
+    TableFlag table;
+    auto row = coded_index<CustomAttributeType>::decode(ctor, table);
+
+    if (table == TableFlag::MethodDef) {
+      MethodDefTable def;
+      _meta.read_row(row, def);
+      signature = def.signature;
+
+      auto owner = _type_defs.method_owner(row);
+      if (owner == NO_ROW) {
+        return false;
+      }
+
+      out.append(_type_defs.resolve(owner));
+      return true;
+    }
+
+    MemberRefTable ref;
+    _meta.read_row(row, ref);
+    signature = ref.signature;
+
+    auto parent = coded_index<MemberRefParent>::decode(ref.cls, table);
+    if (!ref.cls || parent >= _meta.rows_count(table)) {
+      return false;
+    }
+
+    switch (table) {
+      case TableFlag::TypeRef:
+        out.append(_type_refs.resolve(parent).name);
+        return true;
+      case TableFlag::TypeDef:
+        out.append(_type_defs.resolve(parent));
+        return true;
+      case TableFlag::TypeSpec:
+        if (auto spec = _signatures.type_spec(parent)) {
+          out.append(*spec);
+          return true;
+        }
+        return false;
+      default:
+        return false;
+    }
+  }
+
+  // Underlying type of an enum: that of its value__ field if the image defines it, END otherwise.
+  byte enum_type(TableFlag table, dword row) {
+    const auto unknown = as_integral(element_type::END);
+    if (table != TableFlag::TypeDef || row >= _meta.rows_count(table)) {
+      return unknown;
+    }
+
+    TypeDefTable def;
+    _meta.read_row(row, def);
+
+    // FieldList runs are list entries, behind FieldPtr in "#-" streams.
+    auto last = _meta.list_size(TableFlag::Field);
+    if (row + 1 < _meta.rows_count(TableFlag::TypeDef)) {
+      TypeDefTable next;
+      _meta.read_row(row + 1, next);
+      last = std::min(last, next.field_list - 1);
+    }
+
+    for (auto i = def.field_list - 1; i < last; ++i) {
+      FieldTable field;
+      _meta.read_row(_meta.list_row(TableFlag::Field, i), field);
+
+      if (std::string_view(_meta.get_string(field.name)) == "value__") {
+        blob_reader sig(_meta, field.signature);
+        sig.read_byte();
+        auto e = sig.read_byte();
+        return sig.ok() && is_primitive(e) && e != as_integral(element_type::STRING) ? e : unknown;
+      }
+    }
+
+    return unknown;
+  }
+
+  /*
+
+    Same for an enum named in a blob. Names of types in other assemblies
+    are qualified with the assembly and those of nested types have a '+',
+    only the top level types of the image are looked up.
+
+  */
+  byte enum_type(std::string_view name) {
+    if (name.find_first_of(",+") != std::string_view::npos) {
+      return as_integral(element_type::END);
+    }
+
+    auto inserted = _serialized_enums.try_emplace(std::string(name), as_integral(element_type::END));
+    if (!inserted.second) {
+      return inserted.first->second;
+    }
+
+    auto dot = name.rfind('.');
+    auto typeNamespace = dot == std::string_view::npos ? std::string_view() : name.substr(0, dot);
+    auto typeName = dot == std::string_view::npos ? name : name.substr(dot + 1);
+
+    for (dword i = 0; i < _meta.rows_count(TableFlag::TypeDef); ++i) {
+      TypeDefTable def;
+      _meta.read_row(i, def);
+
+      if (typeName == _meta.get_string(def.type_name) && typeNamespace == _meta.get_string(def.type_namespace)
+          && _type_defs.enclosing(i) == NO_ROW) {
+        return inserted.first->second = enum_type(TableFlag::TypeDef, i);
+      }
+    }
+
+    return inserted.first->second;
+  }
+
+  // System.Type, referenced or, in the core library, defined.
+  bool is_system_type(TableFlag table, dword row) {
+    switch (table) {
+      case TableFlag::TypeRef:
+        return _type_refs.resolve(row).name == "System.Type";
+      case TableFlag::TypeDef:
+        return _type_defs.resolve(row) == "System.Type";
+      default:
+        return false;
+    }
+  }
+
+  // A constructor parameter type, as far as attribute arguments may have it.
+  value_type parameter_type(blob_reader& sig, bool element = false) {
+    value_type result;
+    auto e = sig.read_byte();
+
+    if (is_primitive(e)) {
+      result.kind = e;
+      return result;
+    }
+
+    switch (element_type(e)) {
+      case element_type::OBJECT:
+        result.kind = as_integral(attribute_element::BOXED);
+        break;
+
+      case element_type::SZARRAY:
+        if (!element) {
+          result.kind = e;
+          result.element = parameter_type(sig, true).kind;
+        }
+        break;
+
+      case element_type::CLASS:
+      case element_type::VALUETYPE: {
+        TableFlag table;
+        auto row = sig.read_type_token(table);
+        if (!sig.ok() || table == TableFlag::TypeSpec || row >= _meta.rows_count(table)) {
+          break;
+        }
+
+        if (element_type(e) == element_type::VALUETYPE) {
+          result.kind = enum_type(table, row);
+        } else if (is_system_type(table, row)) {
+          result.kind = as_integral(attribute_element::TYPE);
+        }
+        break;
+      }
+
+      default:
+        break;
+    }
+
+    return result;
+  }
+
+  // FieldOrPropType of named arguments and boxed values.
+  value_type serialized_type(blob_reader& blob, bool element = false) {
+    value_type result;
+    auto e = blob.read_byte();
+
+    if (is_primitive(e)) {
+      result.kind = e;
+      return result;
+    }
+
+    switch (attribute_element(e)) {
+      case attribute_element::TYPE:
+      case attribute_element::BOXED:
+        result.kind = e;
+        break;
+
+      case attribute_element::ENUM: {
+        std::string_view name;
+        if (blob.read_ser_string(name)) {
+          result.kind = enum_type(name);
+        }
+        break;
+      }
+
+      default:
+        if (element_type(e) == element_type::SZARRAY && !element) {
+          result.kind = e;
+          result.element = serialized_type(blob, true).kind;
+        }
+        break;
+    }
+
+    return result;
+  }
+
+  static void append_number(std::string& out, const char* format, double value) {
+    char text[32];
+    snprintf(text, sizeof(text), format, value);
+    out.append(text);
+  }
+
+  void argument(blob_reader& blob, value_type type, std::string& out, size_t depth) {
+    if (depth == SIGNATURE_DEPTH_MAX) {
+      blob.fail();
+      return;
+    }
+
+    switch (type.kind) {
+      case as_integral(element_type::BOOLEAN):
+        out.append(blob.read_value<byte>() ? "true" : "false");
+        return;
+      case as_integral(element_type::CHAR):
+        out.append(std::to_string(blob.read_value<word>()));
+        return;
+      case as_integral(element_type::I1):
+        out.append(std::to_string(blob.read_value<int8_t>()));
+        return;
+      case as_integral(element_type::U1):
+        out.append(std::to_string(blob.read_value<uint8_t>()));
+        return;
+      case as_integral(element_type::I2):
+        out.append(std::to_string(blob.read_value<int16_t>()));
+        return;
+      case as_integral(element_type::U2):
+        out.append(std::to_string(blob.read_value<uint16_t>()));
+        return;
+      case as_integral(element_type::I4):
+        out.append(std::to_string(blob.read_value<int32_t>()));
+        return;
+      case as_integral(element_type::U4):
+        out.append(std::to_string(blob.read_value<uint32_t>()));
+        return;
+      case as_integral(element_type::I8):
+        out.append(std::to_string(blob.read_value<int64_t>()));
+        return;
+      case as_integral(element_type::U8):
+        out.append(std::to_string(blob.read_value<uint64_t>()));
+        return;
+      case as_integral(element_type::R4):
+        append_number(out, "%.9g", blob.read_value<float>());
+        return;
+      case as_integral(element_type::R8):
+        append_number(out, "%.17g", blob.read_value<double>());
+        return;
+
+      case as_integral(element_type::STRING):
+      case as_integral(attribute_element::TYPE): {
+        std::string_view text;
+        if (!blob.read_ser_string(text)) {
+          out.append("null");
+        } else if (type.kind == as_integral(element_type::STRING)) {
+          out.append("\"").append(text).append("\"");
+        } else {
+          out.append("typeof(").append(text).append(")");
+        }
+        return;
+      }
+
+      case as_integral(attribute_element::BOXED):
+        argument(blob, serialized_type(blob), out, depth + 1);
+        return;
+
+      case as_integral(element_type::SZARRAY): {
+        auto count = blob.read_value<dword>();
+        if (count == dword(-1)) {
+          out.append("null");
+          return;
+        }
+
+        value_type element;
+        element.kind = type.element;
+
+        out.append("[");
+        for (dword i = 0; i < count && blob.ok(); ++i) {
+          if (i) {
+            out.append(",");
+          }
+          argument(blob, element, out, depth + 1);
+        }
+        out.append("]");
+        return;
+      }
+
+      default:
+        blob.fail();
+    }
+  }
+};
+
+#endif // ATTRIBUTES_HPP_
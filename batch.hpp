@@ -0,0 +1,551 @@
+#pragma once
+
+#ifndef BATCH_HPP_
+#define BATCH_HPP_
+
+#include <atomic>
+#include <condition_variable>
+#include <deque>
+#include <functional>
+#include <memory>
+#include <mutex>
+#include <ostream>
+#include <string>
+#include <thread>
+#include <vector>
+
+#include "image.hpp"
+#include "budget.hpp"
+
+#if defined(__linux__) && __has_include(<linux/io_uring.h>)
+#define HAS_IO_URING
+#include <linux/io_uring.h>
+#include <sys/mman.h>
+#include <sys/syscall.h>
+#endif // __linux__
+
+
+struct batch_settings {
+  size_t inflight;
+  size_t workers;
+  bool   mapped;      // images are mapped instead of read (see image_mapping)
+  bool   triage_only; // images are only classified (see triage_image)
+  file_budget budget; // given to every image
+};
+
+struct batch_item {
+  size_t        index;
+  image_file    file;
+  image_mapping mapping;
+  image_loader  loader;
+  file_budget   budget;
+};
+
+// Invoked on a worker thread once an item has been loaded (or has failed to), its file still open.
+typedef std::function<void(batch_item&)> batch_handler;
+
+
+template<class T>
+class work_queue {
+  std::mutex _lock;
+  std::condition_variable _ready;
+  std::deque<T> _items;
+  bool _closed = false;
+
+public:
+  void push(T item) {
+    {
+      std::lock_guard<std::mutex> guard(_lock);
+      _items.push_back(std::move(item));
+    }
+
+    _ready.notify_one();
+  }
+
+  bool pop(T& item) {
+    std::unique_lock<std::mutex> guard(_lock);
+    _ready.wait(guard, [this] { return _closed || !_items.empty(); });
+
+    if (_items.empty()) {
+      return false;
+    }
+
+    item = std::move(_items.front());
+    _items.pop_front();
+    return true;
+  }
+
+  void close() {
+    {
+      std::lock_guard<std::mutex> guard(_lock);
+      _closed = true;
+    }
+
+    _ready.notify_all();
+  }
+};
+
+
+/*
+
+  Writes the output of batch items in input order, each one as soon as
+  all the items before it are finished. Items are completed from any
+  thread, the streams are flushed once per run of items written.
+
+*/
+class ordered_output {
+  std::mutex _lock;
+  std::ostream& _out;
+  std::ostream& _err;
+
+  std::vector<std::string> _outs;
+  std::vector<std::string> _errs;
+  std::vector<bool> _ready;
+  size_t _next = 0;
+
+public:
+  ordered_output(size_t count, std::ostream& out, std::ostream& err)
+    : _out(out), _err(err), _outs(count), _errs(count), _ready(count) {}
+
+  void complete(size_t index, std::string out, std::string err) {
+    std::lock_guard<std::mutex> guard(_lock);
+
+    _outs[index] = std::move(out);
+    _errs[index] = std::move(err);
+    _ready[index] = true;
+
+    auto first = _next;
+    for (; _next < _ready.size() && _ready[_next]; ++_next) {
+      _err << _errs[_next];
+      _out << _outs[_next];
+
+      std::string().swap(_outs[_next]);
+      std::string().swap(_errs[_next]);
+    }
+
+    if (_next != first) {
+      _err.flush();
+      _out.flush();
+    }
+  }
+};
+
+
+static bool open_batch_item(const std::vector<std::string>& paths,
+    const batch_settings& settings, batch_item& item) {
+
+  if (settings.triage_only) {
+    item.loader.triage_only();
+  }
+
+  item.budget = settings.budget;
+  item.loader.mem_limit(settings.budget.mem_limit());
+
+  if (!item.file.open(paths[item.index].c_str())) {
+    item.loader.fail("Cannot open file");
+    return false;
+  }
+
+  if (!settings.mapped) {
+    item.loader.file_size(item.file.size());
+  }
+
+  return true;
+}
+
+/*
+
+  Fallback reader: every thread walks its own files through the
+  image_loader with blocking preads (or a mapping) and processes them in place.
+
+*/
+static void run_batch_threads(const std::vector<std::string>& paths,
+    const batch_settings& settings, const batch_handler& handler, size_t first = 0) {
+
+  std::atomic<size_t> next(first);
+
+  auto worker = [&] {
+    for (;;) {
+      auto index = next++;
+      if (index >= paths.size()) {
+        break;
+      }
+
+      batch_item item;
+      item.index = index;
+
+      if (open_batch_item(paths, settings, item)) {
+        if (!settings.mapped) {
+          load_image(item.file, item.loader);
+        }
+        else if (item.mapping.map(item.file)) {
+          load_image(item.mapping, item.loader);
+        }
+        else {
+          item.loader.fail("Cannot map file");
+        }
+      }
+
+      handler(item);
+      item.file.close();
+    }
+  };
+
+  std::vector<std::thread> threads;
+  auto threadsCount = std::max(size_t(1), std::min(settings.workers, paths.size() - first));
+
+  for (size_t i = 1; i < threadsCount; ++i) {
+    threads.emplace_back(worker);
+  }
+
+  worker();
+
+  for (auto& t : threads) {
+    t.join();
+  }
+}
+
+
+#ifdef HAS_IO_URING
+
+class io_uring_queue {
+  int _fd = -1;
+
+  void*  _sq_ptr = MAP_FAILED;
+  size_t _sq_size = 0;
+  void*  _cq_ptr = MAP_FAILED;
+  size_t _cq_size = 0;
+  io_uring_sqe* _sqes = static_cast<io_uring_sqe*>(MAP_FAILED);
+  size_t _sqes_size = 0;
+
+  unsigned* _sq_head;
+  unsigned* _sq_tail;
+  unsigned* _sq_mask;
+  unsigned* _sq_array;
+
+  unsigned* _cq_head;
+  unsigned* _cq_tail;
+  unsigned* _cq_mask;
+  io_uring_cqe* _cqes;
+
+  unsigned _to_submit = 0;
+
+public:
+  io_uring_queue() = default;
+  io_uring_queue(const io_uring_queue&) = delete;
+  io_uring_queue& operator =(const io_uring_queue&) = delete;
+
+  ~io_uring_queue() {
+    if (_sqes != MAP_FAILED) munmap(_sqes, _sqes_size);
+    if (_cq_ptr != MAP_FAILED && _cq_ptr != _sq_ptr) munmap(_cq_ptr, _cq_size);
+    if (_sq_ptr != MAP_FAILED) munmap(_sq_ptr, _sq_size);
+    if (_fd >= 0) ::close(_fd);
+  }
+
+  bool init(unsigned entries) {
+    io_uring_params params;
+    memset(&params, 0, sizeof(params));
+
+    _fd = int(syscall(__NR_io_uring_setup, entries, &params));
+    if (_fd < 0 || !supports(IORING_OP_READ)) {
+      return false;
+    }
+
+    _sq_size = params.sq_off.array + params.sq_entries * sizeof(unsigned);
+    _cq_size = params.cq_off.cqes + params.cq_entries * sizeof(io_uring_cqe);
+
+    if (params.features & IORING_FEAT_SINGLE_MMAP) {
+      _sq_size = _cq_size = std::max(_sq_size, _cq_size);
+    }
+
+    _sq_ptr = mmap(nullptr, _sq_size, PROT_READ | PROT_WRITE,
+      MAP_SHARED | MAP_POPULATE, _fd, IORING_OFF_SQ_RING);
+    if (_sq_ptr == MAP_FAILED) {
+      return false;
+    }
+
+    _cq_ptr = (params.features & IORING_FEAT_SINGLE_MMAP) ? _sq_ptr
+      : mmap(nullptr, _cq_size, PROT_READ | PROT_WRITE,
+          MAP_SHARED | MAP_POPULATE, _fd, IORING_OFF_CQ_RING);
+    if (_cq_ptr == MAP_FAILED) {
+      return false;
+    }
+
+    _sqes_size = params.sq_entries * sizeof(io_uring_sqe);
+    _sqes = static_cast<io_uring_sqe*>(mmap(nullptr, _sqes_size, PROT_READ | PROT_WRITE,
+      MAP_SHARED | MAP_POPULATE, _fd, IORING_OFF_SQES));
+    if (_sqes == MAP_FAILED) {
+      return false;
+    }
+
+    auto sq = static_cast<char*>(_sq_ptr);
+    _sq_head  = reinterpret_cast<unsigned*>(sq + params.sq_off.head);
+    _sq_tail  = reinterpret_cast<unsigned*>(sq + params.sq_off.tail);
+    _sq_mask  = reinterpret_cast<unsigned*>(sq + params.sq_off.ring_mask);
+    _sq_array = reinterpret_cast<unsigned*>(sq + params.sq_off.array);
+
+    auto cq = static_cast<char*>(_cq_ptr);
+    _cq_head = reinterpret_cast<unsigned*>(cq + params.cq_off.head);
+    _cq_tail = reinterpret_cast<unsigned*>(cq + params.cq_off.tail);
+    _cq_mask = reinterpret_cast<unsigned*>(cq + params.cq_off.ring_mask);
+    _cqes    = reinterpret_cast<io_uring_cqe*>(cq + params.cq_off.cqes);
+
+    return true;
+  }
+
+  // Kernels before 5.6 have rings but neither IORING_OP_READ nor the probe telling so.
+  bool supports(unsigned op) const {
+    constexpr unsigned OPS_MAX = 256;
+    std::vector<char> buffer(sizeof(io_uring_probe) + OPS_MAX * sizeof(io_uring_probe_op));
+    auto probe = reinterpret_cast<io_uring_probe*>(buffer.data());
+
+    if (syscall(__NR_io_uring_register, _fd, IORING_REGISTER_PROBE, probe, OPS_MAX) < 0) {
+      return false;
+    }
+
+    return op <= probe->last_op && (probe->ops[op].flags & IO_URING_OP_SUPPORTED);
+  }
+
+  void push_read(int fd, const read_request& req, uint64_t user_data) {
+    auto tail = *_sq_tail;
+    auto slot = tail & *_sq_mask;
+
+    auto& sqe = _sqes[slot];
+    memset(&sqe, 0, sizeof(sqe));
+    sqe.opcode = IORING_OP_READ;
+    sqe.fd = fd;
+    sqe.addr = reinterpret_cast<uint64_t>(req.dst);
+    sqe.len = unsigned(std::min(req.size, size_t(0x7ffff000)));
+    sqe.off = uint64_t(req.offset);
+    sqe.user_data = user_data;
+
+    _sq_array[slot] = slot;
+    __atomic_store_n(_sq_tail, tail + 1, __ATOMIC_RELEASE);
+    ++_to_submit;
+  }
+
+  bool submit_and_wait(unsigned waitCount) {
+    for (;;) {
+      auto n = syscall(__NR_io_uring_enter, _fd, _to_submit, waitCount,
+        waitCount ? IORING_ENTER_GETEVENTS : 0, nullptr, 0);
+
+      if (n >= 0) {
+        _to_submit -= unsigned(n);
+        return true;
+      }
+
+      if (errno != EINTR && errno != EAGAIN && errno != EBUSY) {
+        return false;
+      }
+    }
+  }
+
+  // Calls f(user_data, res) for every available completion.
+  template<class F>
+  unsigned reap(F&& f) {
+    unsigned count = 0;
+    auto head = *_cq_head;
+
+    for (;; ++head, ++count) {
+      if (head == __atomic_load_n(_cq_tail, __ATOMIC_ACQUIRE)) {
+        break;
+      }
+
+      auto& cqe = _cqes[head & *_cq_mask];
+      f(cqe.user_data, cqe.res);
+    }
+
+    __atomic_store_n(_cq_head, head, __ATOMIC_RELEASE);
+    return count;
+  }
+};
+
+/*
+
+  Keeps up to `inflight` images loading at once on a single io_uring.
+  Each image advances through its own image_loader as its reads
+  complete, loaded images are handed to `workersCount` threads.
+
+  A slot is held until the handler has finished with the image, which
+  bounds the memory used by loaded but not yet processed blobs.
+
+*/
+static bool run_batch_io_uring(const std::vector<std::string>& paths,
+    const batch_settings& settings, const batch_handler& handler) {
+
+  auto inflight = std::max(size_t(1), std::min(settings.inflight, paths.size()));
+
+  auto ring = std::make_unique<io_uring_queue>();
+  if (!ring->init(unsigned(inflight))) {
+    return false;
+  }
+
+  std::vector<std::unique_ptr<batch_item>> slots(inflight);
+  std::vector<size_t> progress(inflight);
+  std::vector<bool> reading(inflight);
+  std::vector<size_t> freeSlots;
+  std::mutex freeLock;
+  std::condition_variable slotFreed;
+
+  for (size_t i = inflight; i > 0; --i) {
+    freeSlots.push_back(i - 1);
+  }
+
+  work_queue<size_t> loaded;
+  std::vector<std::thread> workers;
+
+  for (size_t i = 0; i < std::max(size_t(1), settings.workers); ++i) {
+    workers.emplace_back([&] {
+      size_t slot;
+      while (loaded.pop(slot)) {
+        auto& item = *slots[slot];
+
+        handler(item);
+        item.file.close();
+
+        slots[slot].reset();
+        {
+          std::lock_guard<std::mutex> guard(freeLock);
+          freeSlots.push_back(slot);
+        }
+
+        slotFreed.notify_one();
+      }
+    });
+  }
+
+  // Queues the next read of the slot's image, or hands the image over when it's loaded.
+  auto advance = [&] (size_t slot) -> bool {
+    auto& item = *slots[slot];
+
+    read_request req;
+    if (item.loader.next(req)) {
+      if (item.loader.current() == image_loader::stage::metadata && progress[slot] == 0) {
+        item.file.advise(req.offset, req.size, POSIX_FADV_WILLNEED);
+      }
+
+      req.offset += progress[slot];
+      req.dst += progress[slot];
+      req.size -= progress[slot];
+
+      ring->push_read(item.file.fd(), req, slot);
+      reading[slot] = true;
+      return true;
+    }
+
+    reading[slot] = false;
+    loaded.push(slot);
+    return false;
+  };
+
+  size_t next = 0;
+  size_t pending = 0;
+  bool ok = true;
+
+  while (next < paths.size() || pending > 0) {
+    {
+      std::unique_lock<std::mutex> guard(freeLock);
+
+      if (pending == 0) {
+        slotFreed.wait(guard, [&] { return !freeSlots.empty(); });
+      }
+
+      while (next < paths.size() && !freeSlots.empty()) {
+        auto slot = freeSlots.back();
+        freeSlots.pop_back();
+
+        guard.unlock();
+
+        slots[slot] = std::make_unique<batch_item>();
+        slots[slot]->index = next++;
+        progress[slot] = 0;
+
+        if (open_batch_item(paths, settings, *slots[slot])) {
+          pending += advance(slot);
+        }
+        else {
+          loaded.push(slot);
+        }
+
+        guard.lock();
+      }
+    }
+
+    if (pending == 0) {
+      continue;
+    }
+
+    if (!ring->submit_and_wait(1)) {
+      ok = false;
+      break;
+    }
+
+    auto completed = ring->reap([&] (uint64_t slot, int res) {
+      auto& item = *slots[slot];
+
+      read_request req = {};
+      item.loader.next(req);
+
+      auto remaining = req.size - progress[slot];
+      if (res > 0 && size_t(res) < remaining) {
+        progress[slot] += res;
+      }
+      else {
+        item.loader.complete(res < 0 ? -1 : ssize_t(progress[slot] + res));
+        progress[slot] = 0;
+      }
+
+      pending += advance(slot);
+    });
+
+    pending -= completed;
+  }
+
+  if (!ok) {
+    // Tear the ring down before any buffer it may still write to is released.
+    ring.reset();
+
+    for (size_t slot = 0; slot < inflight; ++slot) {
+      if (reading[slot]) {
+        slots[slot]->loader.fail("Cannot read image");
+        loaded.push(slot);
+      }
+    }
+  }
+
+  loaded.close();
+  for (auto& t : workers) {
+    t.join();
+  }
+
+  if (next < paths.size()) {
+    run_batch_threads(paths, settings, handler, next);
+  }
+
+  return true;
+}
+
+#endif // HAS_IO_URING
+
+
+/*
+
+  Loads and processes every path, io_uring is preferred when the kernel
+  provides it, otherwise a pool of `workers` threads issues blocking preads.
+  Mapped images are always handled by the thread pool.
+
+*/
+static void run_batch(const std::vector<std::string>& paths,
+    const batch_settings& settings, const batch_handler& handler) {
+
+#ifdef HAS_IO_URING
+  if (!settings.mapped
+      && run_batch_io_uring(paths, settings, handler)) {
+    return;
+  }
+#endif // HAS_IO_URING
+
+  run_batch_threads(paths, settings, handler);
+}
+
+#endif // BATCH_HPP_
@@ -0,0 +1,72 @@
+#pragma once
+
+#ifndef BUDGET_HPP_
+#define BUDGET_HPP_
+
+#include <chrono>
+#include <cstddef>
+
+#include "declarations.hpp"
+
+
+static constexpr dword BUDGET_TICK_INTERVAL = 1024;
+
+/*
+
+  Time and memory a single file may take while it is being decoded.
+
+  Nothing is interrupted: the decode and resolution loops call tick()
+  once per row and sizeable allocations are announced with charge().
+  Once either returns false the file is given up and reported as
+  skipped. The clock is only read every BUDGET_TICK_INTERVAL ticks.
+
+*/
+class file_budget {
+public:
+  typedef std::chrono::steady_clock clock;
+
+  file_budget() = default;
+
+  // Zero stands for no limit.
+  file_budget(std::chrono::milliseconds timeout, size_t memLimit)
+    : _timeout(timeout), _mem_limit(memLimit) {}
+
+  size_t mem_limit() const { return _mem_limit; }
+  const char* exceeded() const { return _exceeded; }
+
+  // Starts the clock, the time before (waiting for I/O) is not counted.
+  void start() {
+    if (_timeout.count()) {
+      _deadline = clock::now() + _timeout;
+    }
+  }
+
+  bool charge(size_t bytes) {
+    _mem_used += bytes;
+    if (_mem_limit && _mem_used > _mem_limit && !_exceeded) {
+      _exceeded = "Memory budget exceeded";
+    }
+
+    return !_exceeded;
+  }
+
+  bool tick() {
+    if (_timeout.count() && ++_ticks % BUDGET_TICK_INTERVAL == 0
+        && !_exceeded && clock::now() > _deadline) {
+      _exceeded = "Time budget exceeded";
+    }
+
+    return !_exceeded;
+  }
+
+private:
+  std::chrono::milliseconds _timeout{0};
+  size_t _mem_limit = 0;
+
+  clock::time_point _deadline = clock::time_point::max();
+  size_t _mem_used = 0;
+  dword _ticks = 0;
+  const char* _exceeded = nullptr;
+};
+
+#endif // BUDGET_HPP_
@@ -0,0 +1,78 @@
+#include <algorithm>
+#include <chrono>
+#include <fstream>
+#include <iomanip>
+#include <iostream>
+#include <iterator>
+#include <limits>
+#include <sstream>
+#include <string>
+#include <vector>
+
+#include "declarations.hpp"
+#include "tables.hpp"
+#include "utility.hpp"
+
+#include "diag.hpp"
+
+#include "image.hpp"
+#include "metadata.hpp"
+
+
+using namespace std;
+
+
+/*
+
+  Crafted images for check.sh: copies of a sound image with a defect
+  each, which assembly is to reject or get through, never to crash on.
+
+    null-memberref-class.dll   every MemberRef.Class is null
+
+*/
+static bool write_image(const string& path, const vector<char>& data) {
+  ofstream out(path, ios::binary);
+  out.write(data.data(), streamsize(data.size()));
+  return bool(out);
+}
+
+int main(int argc, const char *argv[]) {
+  if (argc != 3) {
+    cerr << "USAGE: check <path/to/assembly.dll> <output directory>" << endl;
+    return 1;
+  }
+
+  image_file file;
+  image_loader image;
+  if (!file.open(argv[1]) || !load_image(file, image)) {
+    cerr << "Cannot load '" << argv[1] << "'" << endl;
+    return -2;
+  }
+
+  metadata meta;
+  file_budget budget;
+  if (auto error = read_metadata(image.meta_data, image.meta_size, meta, budget)) {
+    cerr << error << endl;
+    return -3;
+  }
+
+  ifstream in(argv[1], ios::binary);
+  vector<char> original((istreambuf_iterator<char>(in)), istreambuf_iterator<char>());
+
+  auto output = string(argv[2]) + "/";
+
+  // Class is the first column of MemberRef rows.
+  auto crafted = original;
+  auto width = meta.index_size.coded_cols[MemberRefParent::id];
+  for (dword i = 0; i < meta.rows_count(TableFlag::MemberRef); ++i) {
+    auto offset = image.meta_offset + (meta.row(TableFlag::MemberRef, i) - meta.base);
+    fill_n(crafted.begin() + offset, width, 0);
+  }
+
+  if (!write_image(output + "null-memberref-class.dll", crafted)) {
+    cerr << "Cannot write to '" << argv[2] << "'" << endl;
+    return -2;
+  }
+
+  return 0;
+}
@@ -0,0 +1,25 @@
+#!/bin/sh
+
+. ./prepare_.sh
+CRAFTED=./build/crafted
+mkdir $CRAFTED 2>/dev/null
+
+g++ -x c++ --std=c++17 $CC_FLAGS -mpopcnt -pthread -O2 -o build/assembly assembly.cpp\
+	&& g++ -x c++ --std=c++17 $CC_FLAGS -mpopcnt -pthread -O2 -o build/check check.cpp\
+	&& ./build/check "$DLL" $CRAFTED\
+	|| exit 1
+
+# Errors exit with 252 to 255, signals with 128 and up.
+FAILED=0
+for IMAGE in $CRAFTED/*.dll; do
+	for MODE in "" --calls --attributes --instantiations "--members --signatures"; do
+		$APP $MODE "$IMAGE" >/dev/null 2>&1
+		CODE=$?
+		if [ $CODE -gt 128 ] && [ $CODE -lt 252 ]; then
+			echo "$IMAGE $MODE: killed by signal $((CODE - 128))"
+			FAILED=1
+		fi
+	done
+done
+
+exit $FAILED
@@ -0,0 +1,260 @@
+#pragma once
+
+#ifndef CIL_HPP_
+#define CIL_HPP_
+
+#include <algorithm>
+#include <cstring>
+
+#include "declarations.hpp"
+#include "image.hpp"
+
+
+/*
+
+  Method bodies (II.25.4) of a mapped image, located by their RVA through
+  the section table. Bodies are mostly asked for in RVA order, so the
+  section of the previous one is tried first.
+
+*/
+class method_bodies {
+public:
+  method_bodies(const image_loader& image, const image_mapping& mapping)
+    : _sections(image.section_headers), _data(mapping.data()), _size(mapping.size()) {}
+
+  // IL code of the body at rva, false if it is not within the image or its header is malformed.
+  bool code(dword rva, const byte*& code, dword& size) {
+    auto p = at(rva);
+    if (!p) {
+      return false;
+    }
+
+    auto available = size_t(_data + _size - reinterpret_cast<const char*>(p));
+
+    switch (p[0] & 0x03) {
+      case TINY_FORMAT:
+        code = p + 1;
+        size = p[0] >> 2;
+        return size < available;
+
+      case FAT_FORMAT: {
+        if (available < FAT_HEADER_SIZE) {
+          return false;
+        }
+
+        word flags;
+        memcpy(&flags, p, sizeof(flags));
+        memcpy(&size, p + 4, sizeof(size));
+
+        size_t headerSize = (flags >> 12) * sizeof(dword);
+        if (headerSize < FAT_HEADER_SIZE || headerSize > available || size > available - headerSize) {
+          return false;
+        }
+
+        code = p + headerSize;
+        return true;
+      }
+
+      default:
+        return false;
+    }
+  }
+
+private:
+  static constexpr byte TINY_FORMAT = 0x02;
+  static constexpr byte FAT_FORMAT = 0x03;
+  static constexpr size_t FAT_HEADER_SIZE = 12;
+
+  const std::vector<SectionHeadersEntry>& _sections;
+  const char* _data;
+  size_t _size;
+  size_t _last = 0;
+
+  const byte* at(dword rva) {
+    auto within = [rva] (const SectionHeadersEntry& entry) {
+      return entry.rva <= rva && rva - entry.rva < std::min(entry.sz_raw, entry.sz_virt);
+    };
+
+    if (_last >= _sections.size() || !within(_sections[_last])) {
+      auto found = std::find_if(_sections.begin(), _sections.end(), within);
+      if (found == _sections.end()) {
+        return nullptr;
+      }
+
+      _last = found - _sections.begin();
+    }
+
+    auto& entry = _sections[_last];
+    auto offset = qword(entry.file_offset) + (rva - entry.rva);
+    if (offset >= _size) {
+      return nullptr;
+    }
+
+    return reinterpret_cast<const byte*>(_data + offset);
+  }
+};
+
+
+enum class cil_opcode : word {
+  CALL = 0x28,
+  CALLVIRT = 0x6F,
+  LDSTR = 0x72,
+  NEWOBJ = 0x73,
+  LDFLD = 0x7B,
+  LDSFLD = 0x7E,
+  SWITCH = 0x45,
+  PREFIX = 0xFE,    // of the two byte opcodes
+};
+
+/*
+
+  Operand lengths of the one and two byte opcodes (III.1.2), so that the
+  scanner steps over instructions with one lookup. Unused opcodes are
+  INVALID, switch has its own variable length.
+
+*/
+struct cil_operands {
+  static constexpr byte INVALID = 0xFF;
+  static constexpr byte VARIABLE = 0xFE;
+
+  byte one[256];
+  byte two[256];
+
+  constexpr cil_operands() : one(), two() {
+    for (auto& length : one) {
+      length = INVALID;
+    }
+    for (auto& length : two) {
+      length = INVALID;
+    }
+
+    set(one, 0x00, 0x0D, 0);  // nop .. stloc.3
+    set(one, 0x0E, 0x13, 1);  // ldarg.s .. stloc.s
+    set(one, 0x14, 0x1E, 0);  // ldnull .. ldc.i4.8
+    set(one, 0x1F, 0x1F, 1);  // ldc.i4.s
+    set(one, 0x20, 0x20, 4);  // ldc.i4
+    set(one, 0x21, 0x21, 8);  // ldc.i8
+    set(one, 0x22, 0x22, 4);  // ldc.r4
+    set(one, 0x23, 0x23, 8);  // ldc.r8
+    set(one, 0x25, 0x26, 0);  // dup, pop
+    set(one, 0x27, 0x29, 4);  // jmp, call, calli
+    set(one, 0x2A, 0x2A, 0);  // ret
+    set(one, 0x2B, 0x37, 1);  // br.s .. blt.un.s
+    set(one, 0x38, 0x44, 4);  // br .. blt.un
+    set(one, 0x45, 0x45, VARIABLE);  // switch
+    set(one, 0x46, 0x6E, 0);  // ldind.i1 .. conv.u8
+    set(one, 0x6F, 0x75, 4);  // callvirt .. isinst
+    set(one, 0x76, 0x76, 0);  // conv.r.un
+    set(one, 0x79, 0x79, 4);  // unbox
+    set(one, 0x7A, 0x7A, 0);  // throw
+    set(one, 0x7B, 0x81, 4);  // ldfld .. stobj
+    set(one, 0x82, 0x8B, 0);  // conv.ovf.i1.un .. conv.ovf.u.un
+    set(one, 0x8C, 0x8D, 4);  // box, newarr
+    set(one, 0x8E, 0x8E, 0);  // ldlen
+    set(one, 0x8F, 0x8F, 4);  // ldelema
+    set(one, 0x90, 0xA2, 0);  // ldelem.i1 .. stelem.ref
+    set(one, 0xA3, 0xA5, 4);  // ldelem, stelem, unbox.any
+    set(one, 0xB3, 0xBA, 0);  // conv.ovf.i1 .. conv.ovf.u8
+    set(one, 0xC2, 0xC2, 4);  // refanyval
+    set(one, 0xC3, 0xC3, 0);  // ckfinite
+    set(one, 0xC6, 0xC6, 4);  // mkrefany
+    set(one, 0xD0, 0xD0, 4);  // ldtoken
+    set(one, 0xD1, 0xDC, 0);  // conv.u2 .. endfinally
+    set(one, 0xDD, 0xDD, 4);  // leave
+    set(one, 0xDE, 0xDE, 1);  // leave.s
+    set(one, 0xDF, 0xE0, 0);  // stind.i, conv.u
+
+    set(two, 0x00, 0x05, 0);  // arglist .. clt.un
+    set(two, 0x06, 0x07, 4);  // ldftn, ldvirtftn
+    set(two, 0x09, 0x0E, 2);  // ldarg .. stloc
+    set(two, 0x0F, 0x0F, 0);  // localloc
+    set(two, 0x11, 0x11, 0);  // endfilter
+    set(two, 0x12, 0x12, 1);  // unaligned.
+    set(two, 0x13, 0x14, 0);  // volatile., tail.
+    set(two, 0x15, 0x16, 4);  // initobj, constrained.
+    set(two, 0x17, 0x18, 0);  // cpblk, initblk
+    set(two, 0x19, 0x19, 1);  // no.
+    set(two, 0x1A, 0x1A, 0);  // rethrow
+    set(two, 0x1C, 0x1C, 4);  // sizeof
+    set(two, 0x1D, 0x1E, 0);  // refanytype, readonly.
+  }
+
+private:
+  static constexpr void set(byte (&table)[256], size_t first, size_t last, byte length) {
+    for (auto i = first; i <= last; ++i) {
+      table[i] = length;
+    }
+  }
+};
+
+static constexpr cil_operands CIL_OPERANDS;
+
+/*
+
+  Walks the instructions of IL code and hands the metadata tokens of the
+  call, callvirt, newobj, ldfld and ldsfld ones, as well as the #US
+  offsets of ldstr, to f(opcode, token).
+  Returns false if the code is malformed: an unused opcode or an operand
+  running past its end; tokens before that have been handed out.
+
+*/
+template<class F>
+static bool scan_call_sites(const byte* code, dword size, F&& f) {
+  auto p = code;
+  auto end = code + size;
+
+  while (p != end) {
+    auto op = *p++;
+    auto length = CIL_OPERANDS.one[op];
+
+    if (op == as_integral(cil_opcode::PREFIX)) {
+      if (p == end) {
+        return false;
+      }
+      length = CIL_OPERANDS.two[*p++];
+    }
+
+    if (length == cil_operands::VARIABLE) {
+      dword targets;
+      if (size_t(end - p) < sizeof(targets)) {
+        return false;
+      }
+
+      memcpy(&targets, p, sizeof(targets));
+      p += sizeof(targets);
+
+      length = 0;
+      if (targets > size_t(end - p) / sizeof(dword)) {
+        return false;
+      }
+      p += targets * sizeof(dword);
+    }
+
+    if (length == cil_operands::INVALID || size_t(end - p) < length) {
+      return false;
+    }
+
+    switch (cil_opcode(op)) {
+      case cil_opcode::CALL:
+      case cil_opcode::CALLVIRT:
+      case cil_opcode::LDSTR:
+      case cil_opcode::NEWOBJ:
+      case cil_opcode::LDFLD:
+      case cil_opcode::LDSFLD: {
+        dword token;
+        memcpy(&token, p, sizeof(token));
+        f(cil_opcode(op), token);
+        break;
+      }
+
+      default:
+        break;
+    }
+
+    p += length;
+  }
+
+  return true;
+}
+
+#endif // CIL_HPP_
@@ -1,5 +1,5 @@
 #!/bin/sh
 
 . ./prepare_.sh
-g++ -x c++ --std=c++17 $CC_FLAGS -mpopcnt -g -o build/assembly assembly.cpp\
+g++ -x c++ --std=c++17 $CC_FLAGS -mpopcnt -pthread -g -o build/assembly assembly.cpp\
 	&& gdb --args $APP "$DLL"
\ No newline at end of file
@@ -42,6 +42,15 @@ typedef struct {
   dword base_of_data;
 } HDR_COFF_STD;
 
+typedef struct {
+  word  magic;          // 020b
+  word  skipped;
+  dword sz_code;
+  qword sz_data;
+  dword rva_entry_point;
+  dword base_of_code;
+} HDR_COFF_STD64;
+
 typedef struct {
   dword image_base;
   dword sectioshift_alignment;
@@ -65,6 +74,29 @@ typedef struct {
   dword num_data_dirs;
 } HDR_COFF_WIN;
 
+typedef struct {
+  qword image_base;
+  dword sectioshift_alignment;
+  dword file_alignment;
+  word  os_major;
+  word  os_minor;
+  word  user_major;
+  word  user_minor;
+  word  subsystem_major;
+  word  subsystem_minor;
+  dword reserved;
+  dword sz_image;
+  dword sz_header;
+  dword file_checksum;
+  dword flags_dll;
+  qword sz_stack_reserve;
+  qword sz_stack_commit;
+  qword sz_heap_reserve;
+  qword sz_heap_commit;
+  dword flags_loader;
+  dword num_data_dirs;
+} HDR_COFF_WIN64;
+
 struct RvaAndSize {
   dword rva;
   dword sz;
@@ -81,7 +113,8 @@ typedef struct {
   qword      rva_sshift_sig;
   qword      skipped_cmt; // Code Manager Table
   qword      rva_vt_fixups;
-  qword      skipped[2];
+  qword      skipped;
+  RvaAndSize native_header; // ReadyToRun header
 } HDR_CLI;
 
 typedef RvaAndSize DataDirsEntry;
@@ -135,6 +168,28 @@ enum class HeapSizesFlags : byte {
   String = 0x01,
   Guid   = 0x02,
   Blob   = 0x04,
+
+/*
+
+  Uncompressed ("#-") streams only: a dword of extra data
+  follows the rows count array.
+
+*/
+
+  ExtraData = 0x40,
+};
+
+enum class AssemblyFlags : dword {
+
+/*
+
+  The public key column holds the full key rather than its token,
+  always the case for the Assembly table.
+
+*/
+
+  PublicKey = 0x0001,
+  Retargetable = 0x0100,
 };
 
 enum class TableFlag : unsigned short {
@@ -148,10 +203,14 @@ enum class TableFlag : unsigned short {
   Constant = 0x0B,
   CustomAttribute = 0x0C,
   DeclSecurity =0x0E,
+  ENCLog = 0x1E,
+  ENCMap = 0x1F,
   EventMap = 0x12,
   Event = 0x14,
+  EventPtr = 0x13,
   ExportedType = 0x27,
   Field = 0x04,
+  FieldPtr = 0x03,
   FieldLayout = 0x10,
   FieldMarshal = 0x0D,
   FieldRVA = 0x1D,
@@ -163,6 +222,7 @@ enum class TableFlag : unsigned short {
   ManifestResource = 0x28,
   MemberRef = 0x0A,
   MethodDef = 0x06,
+  MethodPtr = 0x05,
   MethodImpl = 0x19,
   MethodSemantics = 0x18,
   MethodSpec = 0x2B,
@@ -170,7 +230,9 @@ enum class TableFlag : unsigned short {
   ModuleRef = 0x1A,
   NestedClass = 0x29,
   Param = 0x08,
+  ParamPtr = 0x07,
   Property = 0x17,
+  PropertyPtr = 0x16,
   PropertyMap = 0x15,
   StandAloneSig = 0x11,
   TypeDef = 0x02,
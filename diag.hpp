@@ -45,10 +45,14 @@ TABLE_FLAG_CASE_(ClassLayout);
 TABLE_FLAG_CASE_(Constant);
 TABLE_FLAG_CASE_(CustomAttribute);
 TABLE_FLAG_CASE_(DeclSecurity);
+TABLE_FLAG_CASE_(ENCLog);
+TABLE_FLAG_CASE_(ENCMap);
 TABLE_FLAG_CASE_(EventMap);
 TABLE_FLAG_CASE_(Event);
+TABLE_FLAG_CASE_(EventPtr);
 TABLE_FLAG_CASE_(ExportedType);
 TABLE_FLAG_CASE_(Field);
+TABLE_FLAG_CASE_(FieldPtr);
 TABLE_FLAG_CASE_(FieldLayout);
 TABLE_FLAG_CASE_(FieldMarshal);
 TABLE_FLAG_CASE_(FieldRVA);
@@ -60,6 +64,7 @@ TABLE_FLAG_CASE_(InterfaceImpl);
 TABLE_FLAG_CASE_(ManifestResource);
 TABLE_FLAG_CASE_(MemberRef);
 TABLE_FLAG_CASE_(MethodDef);
+TABLE_FLAG_CASE_(MethodPtr);
 TABLE_FLAG_CASE_(MethodImpl);
 TABLE_FLAG_CASE_(MethodSemantics);
 TABLE_FLAG_CASE_(MethodSpec);
@@ -67,7 +72,9 @@ TABLE_FLAG_CASE_(Module);
 TABLE_FLAG_CASE_(ModuleRef);
 TABLE_FLAG_CASE_(NestedClass);
 TABLE_FLAG_CASE_(Param);
+TABLE_FLAG_CASE_(ParamPtr);
 TABLE_FLAG_CASE_(Property);
+TABLE_FLAG_CASE_(PropertyPtr);
 TABLE_FLAG_CASE_(PropertyMap);
 TABLE_FLAG_CASE_(StandAloneSig);
 TABLE_FLAG_CASE_(TypeDef);
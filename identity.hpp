@@ -0,0 +1,126 @@
+#pragma once
+
+#ifndef IDENTITY_HPP_
+#define IDENTITY_HPP_
+
+#include <string>
+#include <unordered_map>
+
+#include "declarations.hpp"
+#include "tables.hpp"
+#include "metadata.hpp"
+#include "interner.hpp"
+#include "sha1.hpp"
+
+
+static constexpr size_t PUBLIC_KEY_TOKEN_SIZE = 8;
+
+/*
+
+  What tells assemblies apart beyond their name. Strings are
+  string_interner ids, so equal identities compare equal member-wise.
+
+*/
+struct assembly_identity {
+  dword name = 0;
+  dword culture = 0;    // empty for neutral
+  dword token = 0;      // public key token in hex, empty if there is none
+  qword version = 0;    // major, minor, build and revision, from the high word down
+
+  bool operator ==(const assembly_identity& other) const {
+    return name == other.name && culture == other.culture
+      && token == other.token && version == other.version;
+  }
+
+  bool operator !=(const assembly_identity& other) const {
+    return !(*this == other);
+  }
+
+  static qword pack_version(word major, word minor, word build, word revision) {
+    return qword(major) << 48 | qword(minor) << 32 | qword(build) << 16 | revision;
+  }
+
+  std::string version_string() const {
+    return std::to_string(word(version >> 48)) + '.' + std::to_string(word(version >> 32))
+      + '.' + std::to_string(word(version >> 16)) + '.' + std::to_string(word(version));
+  }
+};
+
+/*
+
+  Reads assembly identities of one image. Full public keys are hashed into
+  their tokens once per blob, AssemblyRefs of one image tend to share them.
+
+*/
+class identity_reader {
+public:
+  identity_reader(const metadata& meta, string_interner& strings)
+    : _meta(meta), _strings(strings) {}
+
+  assembly_identity assembly_ref(const AssemblyRefTable& row) {
+    return {
+      _strings.intern(_meta.get_string(row.name)),
+      _strings.intern(_meta.get_string(row.culture)),
+      token(row.public_key_or_token, has_flag(row.flags, AssemblyFlags::PublicKey)),
+      assembly_identity::pack_version(row.ver_major, row.ver_minor, row.num_build, row.num_revision),
+    };
+  }
+
+  // The Assembly row always holds the full key.
+  assembly_identity assembly(const AssemblyTable& row) {
+    return {
+      _strings.intern(_meta.get_string(row.name)),
+      _strings.intern(_meta.get_string(row.culture)),
+      token(row.public_key, true),
+      assembly_identity::pack_version(row.ver_major, row.ver_minor, row.num_build, row.num_revision),
+    };
+  }
+
+private:
+  const metadata& _meta;
+  string_interner& _strings;
+
+  // Interned tokens by blob index, with the full key flag in the lowest bit.
+  std::unordered_map<qword, dword> _tokens;
+
+  dword token(dword blob, bool fullKey) {
+    auto key = qword(blob) << 1 | fullKey;
+
+    auto found = _tokens.find(key);
+    if (found != _tokens.end()) {
+      return found->second;
+    }
+
+    dword length;
+    auto bytes = reinterpret_cast<const byte*>(_meta.get_blob(blob, length));
+
+    byte digest[sha1::DIGEST_SIZE];
+    byte reversed[PUBLIC_KEY_TOKEN_SIZE];
+
+    if (fullKey && length) {
+      sha1 hash;
+      hash.update(bytes, length);
+      hash.finish(digest);
+
+      for (size_t i = 0; i < PUBLIC_KEY_TOKEN_SIZE; ++i) {
+        reversed[i] = digest[sha1::DIGEST_SIZE - 1 - i];
+      }
+
+      bytes = reversed;
+      length = PUBLIC_KEY_TOKEN_SIZE;
+    }
+
+    static constexpr char digits[] = "0123456789abcdef";
+
+    std::string hex;
+    hex.reserve(length * 2);
+    for (dword i = 0; i < length; ++i) {
+      hex += digits[bytes[i] >> 4];
+      hex += digits[bytes[i] & 0x0F];
+    }
+
+    return _tokens[key] = _strings.intern(hex);
+  }
+};
+
+#endif // IDENTITY_HPP_
@@ -0,0 +1,577 @@
+#pragma once
+
+#ifndef IMAGE_HPP_
+#define IMAGE_HPP_
+
+#include <algorithm>
+#include <cerrno>
+#include <cstdlib>
+#include <cstring>
+#include <memory>
+#include <vector>
+
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <sys/types.h>
+#include <unistd.h>
+
+#include "declarations.hpp"
+#include "utility.hpp"
+#include "diag.hpp"
+#include "triage.hpp"
+
+
+static constexpr size_t BUFFER_ALIGNMENT = 4096;
+
+/*
+
+  Heap block aligned to BUFFER_ALIGNMENT, so that whole regions
+  of the image can be read with a single pread and decoded in place.
+
+*/
+class aligned_buffer {
+  struct deleter {
+    void operator()(char* p) const { free(p); }
+  };
+
+  std::unique_ptr<char, deleter> _data;
+  size_t _size = 0;
+
+public:
+  aligned_buffer() = default;
+
+  explicit aligned_buffer(size_t size) {
+    allocate(size);
+  }
+
+  bool allocate(size_t size) {
+    void* p = nullptr;
+    if (posix_memalign(&p, BUFFER_ALIGNMENT, round_up(BUFFER_ALIGNMENT, size | 1))) {
+      _data.reset();
+      _size = 0;
+      return false;
+    }
+
+    _data.reset(static_cast<char*>(p));
+    _size = size;
+    return true;
+  }
+
+  char* data() const { return _data.get(); }
+  size_t size() const { return _size; }
+};
+
+class image_file {
+  int _fd = -1;
+
+public:
+  image_file() = default;
+  image_file(const image_file&) = delete;
+  image_file& operator =(const image_file&) = delete;
+
+  ~image_file() {
+    close();
+  }
+
+  bool open(const char* path) {
+    close();
+
+    _fd = ::open(path, O_RDONLY);
+    if (_fd < 0) {
+      return false;
+    }
+
+    // Only headers and a few metadata streams are ever needed: keep the kernel
+    // from reading ahead into IL, resources and whatever else the image carries.
+    advise(0, 0, POSIX_FADV_RANDOM);
+    return true;
+  }
+
+  void close() {
+    if (_fd >= 0) {
+      ::close(_fd);
+      _fd = -1;
+    }
+  }
+
+  int fd() const { return _fd; }
+
+  explicit operator bool() const { return _fd >= 0; }
+
+  // Length of the file, 0 if it cannot be told.
+  size_t size() const {
+    struct stat st;
+    return !fstat(_fd, &st) && st.st_size > 0 ? size_t(st.st_size) : 0;
+  }
+
+  // Reads up to `size` bytes at `offset`, short reads are retried until the end of file.
+  ssize_t read_some(off_t offset, void* dst, size_t size) const {
+    auto p = static_cast<char*>(dst);
+    size_t count = 0;
+
+    while (count < size) {
+      auto n = ::pread(_fd, p + count, size - count, offset + off_t(count));
+      if (n < 0 && errno == EINTR) {
+        continue;
+      }
+
+      if (n < 0) {
+        return -1;
+      }
+
+      if (n == 0) {
+        break;
+      }
+
+      count += size_t(n);
+    }
+
+    return ssize_t(count);
+  }
+
+  // Reads exactly `size` bytes at `offset`.
+  bool read(off_t offset, void* dst, size_t size) const {
+    return read_some(offset, dst, size) == ssize_t(size);
+  }
+
+  template<class T>
+  bool read(off_t offset, T& dst) const {
+    return read(offset, &dst, sizeof(dst));
+  }
+
+  void advise(off_t offset, size_t size, int advice) const {
+    posix_fadvise(_fd, offset, off_t(size), advice);
+  }
+};
+
+/*
+
+  Read-only mapping of a whole image, used instead of reads with --mmap.
+  Pages are only brought in for the ranges actually decoded, see advise().
+
+*/
+class image_mapping {
+  const char* _data = nullptr;
+  size_t _size = 0;
+
+public:
+  image_mapping() = default;
+  image_mapping(const image_mapping&) = delete;
+  image_mapping& operator =(const image_mapping&) = delete;
+
+  ~image_mapping() {
+    unmap();
+  }
+
+  bool map(const image_file& file) {
+    unmap();
+
+    struct stat st;
+    if (fstat(file.fd(), &st) || st.st_size <= 0) {
+      return false;
+    }
+
+    auto p = mmap(nullptr, size_t(st.st_size), PROT_READ, MAP_PRIVATE, file.fd(), 0);
+    if (p == MAP_FAILED) {
+      return false;
+    }
+
+    _data = static_cast<const char*>(p);
+    _size = size_t(st.st_size);
+
+    advise(0, _size, POSIX_MADV_RANDOM);
+    return true;
+  }
+
+  void unmap() {
+    if (_data) {
+      munmap(const_cast<char*>(_data), _size);
+      _data = nullptr;
+      _size = 0;
+    }
+  }
+
+  const char* data() const { return _data; }
+  size_t size() const { return _size; }
+
+  ssize_t read_some(off_t offset, void* dst, size_t size) const {
+    if (offset < 0 || size_t(offset) > _size) {
+      return -1;
+    }
+
+    size = std::min(size, _size - size_t(offset));
+    memcpy(dst, _data + offset, size);
+    return ssize_t(size);
+  }
+
+  void advise(off_t offset, size_t size, int advice) const {
+    if (offset < 0 || size_t(offset) >= _size) {
+      return;
+    }
+
+    auto first = round_down(BUFFER_ALIGNMENT, size_t(offset));
+    auto last = std::min(_size, size_t(offset) + size);
+
+    posix_madvise(const_cast<char*>(_data) + first, last - first, advice);
+  }
+};
+
+
+template<class InputIt>
+off_t find_file_offset(const RvaAndSize& dst, InputIt first, InputIt last) {
+  auto found = std::find_if(first, last, [&dst] (auto& entry) {
+    return entry.rva <= dst.rva && qword(dst.rva) + dst.sz <= qword(entry.rva) + entry.sz_virt; });
+
+  return found != last ?
+    found->file_offset + dst.rva - found->rva
+      : -1;
+}
+
+template<class InputIt>
+bool try_find_file_offset(const RvaAndSize& dst, InputIt first, InputIt last, off_t& out_offset) {
+  auto found = std::find_if(first, last, [&dst] (auto& entry) {
+    return entry.rva <= dst.rva && qword(dst.rva) + dst.sz <= qword(entry.rva) + entry.sz_virt; });
+
+  if (found != last) {
+    out_offset = found->file_offset + dst.rva - found->rva;
+    return true;
+  }
+
+  return false;
+}
+
+
+struct read_request {
+  off_t  offset;
+  char*  dst;
+  size_t size;
+};
+
+/*
+
+  Loads everything the metadata reader needs from an image as a chain
+  of dependent reads. The first one takes the triage window (the first
+  TRIAGE_WINDOW bytes): MS-DOS and COFF headers, data directories and
+  usually the section table and even the CLI header are decoded from it.
+  Whatever is not inside the window is read next, followed by the
+  metadata blob.
+
+  Images which triage finds not to be managed are skipped right after
+  the first read, images whose metadata blob is over the memory limit
+  are given up before it is allocated.
+
+  The loader does no I/O on its own: it hands out the next read_request
+  and advances once that read has been completed, so the same state
+  machine serves both the synchronous path and the batch readers.
+
+*/
+class image_loader {
+public:
+  enum class stage {
+    head,
+    sections,
+    cli,
+    metadata,
+    done,
+    skipped,
+    over_budget,
+    failed,
+  };
+
+  triage_info  triage;
+
+  HDR_MSDOS      hdr_msdos;
+  HDR_COFF       hdr_coff;
+  HDR_CLI        hdr_cli;
+
+  // Either pair is valid depending on the optional header magic.
+  HDR_COFF_STD   hdr_coff_std;
+  HDR_COFF_WIN   hdr_coff_win;
+  HDR_COFF_STD64 hdr_coff_std64;
+  HDR_COFF_WIN64 hdr_coff_win64;
+
+  std::vector<DataDirsEntry> data_dirs;
+  std::vector<SectionHeadersEntry> section_headers;
+
+  off_t          meta_offset = -1;
+  aligned_buffer meta_blob;
+
+  // Metadata blob: either meta_blob or a part of the mapped image.
+  const char* meta_data = nullptr;
+  size_t      meta_size = 0;
+
+  stage current() const { return _stage; }
+  const char* error() const { return _error; }
+
+  bool is_pe32plus() const {
+    return triage.magic == OPT_MAGIC_PE32PLUS;
+  }
+
+  qword image_base() const {
+    return is_pe32plus() ? hdr_coff_win64.image_base : hdr_coff_win.image_base;
+  }
+
+  // The metadata blob is then referenced in place instead of being read.
+  void map(const image_mapping& mapping) {
+    _mapping = &mapping;
+  }
+
+  // Stops right after the image has been classified.
+  void triage_only() {
+    _triage_only = true;
+  }
+
+  // Largest metadata blob to be read into memory, 0 for any.
+  void mem_limit(size_t limit) {
+    _mem_limit = limit;
+  }
+
+  // Length of the image file when it is read rather than mapped, 0 if unknown.
+  void file_size(size_t size) {
+    _file_size = size;
+  }
+
+  bool next(read_request& req) {
+    switch (_stage) {
+      case stage::head:
+        req = { 0, _scratch.data(), _scratch.size() };
+        return true;
+      case stage::sections:
+        req = { off_t(triage.sections_offset), _scratch.data(), _scratch.size() };
+        return true;
+      case stage::cli:
+        req = { _cli_offset, reinterpret_cast<char*>(&hdr_cli), sizeof(hdr_cli) };
+        return true;
+      case stage::metadata:
+        req = { meta_offset, meta_blob.data(), meta_blob.size() };
+        return true;
+      default:
+        return false;
+    }
+  }
+
+  // Takes the count of bytes the last request has got, or -1 on error.
+  // Only the triage window may come short, when the file itself is smaller.
+  void complete(ssize_t count) {
+    read_request req = {};
+    if (!next(req)) {
+      return;
+    }
+
+    if (count < 0 || (size_t(count) != req.size && _stage != stage::head)) {
+      return fail("Cannot read image");
+    }
+
+    switch (_stage) {
+      case stage::head:
+        return on_head(size_t(count));
+      case stage::sections:
+        memcpy(section_headers.data(), _scratch.data(), _scratch.size());
+        return on_sections();
+      case stage::cli:
+        return on_cli();
+      case stage::metadata:
+        _stage = stage::done;
+        break;
+      default:
+        break;
+    }
+  }
+
+  void fail(const char* message) {
+    _error = message;
+    _stage = stage::failed;
+  }
+
+private:
+  stage _stage = stage::head;
+  const char* _error = nullptr;
+  bool _triage_only = false;
+  size_t _mem_limit = 0;
+  size_t _file_size = 0;
+
+  const image_mapping* _mapping = nullptr;
+
+  std::vector<char> _scratch = std::vector<char>(TRIAGE_WINDOW);
+  size_t _head_size = 0;
+  off_t _cli_offset = -1;
+
+  void on_head(size_t size) {
+    auto head = _scratch.data();
+    _head_size = size;
+
+    triage = triage_image(head, size);
+
+    if (triage.kind == image_kind::corrupt) {
+      return fail(triage.reason);
+    }
+
+    if (_triage_only) {
+      _stage = stage::done;
+      return;
+    }
+
+    if (!triage.is_managed()) {
+      _error = "Not a managed image";
+      _stage = stage::skipped;
+      return;
+    }
+
+    memcpy(&hdr_msdos, head, sizeof(hdr_msdos));
+
+    auto p = head + hdr_msdos.e_lfanew;
+    memcpy(&hdr_coff, p, sizeof(hdr_coff));
+    p += sizeof(hdr_coff);
+
+    // Both layouts are within the window already, triage has seen num_data_dirs.
+    if (is_pe32plus()) {
+      memcpy(&hdr_coff_std64, p, sizeof(hdr_coff_std64));
+      p += sizeof(hdr_coff_std64);
+      memcpy(&hdr_coff_win64, p, sizeof(hdr_coff_win64));
+    } else {
+      memcpy(&hdr_coff_std, p, sizeof(hdr_coff_std));
+      p += sizeof(hdr_coff_std);
+      memcpy(&hdr_coff_win, p, sizeof(hdr_coff_win));
+    }
+
+    DIAGNOSTICS(
+      std::cout << "Image Base:" << std::endl;
+      std::cout << "  " << image_base() << (is_pe32plus() ? " (PE32+)" : "") << std::endl;
+      std::cout << std::endl;
+    );
+
+    data_dirs.resize(std::min<size_t>(triage.num_data_dirs,
+      (size - triage.dirs_offset) / sizeof(DataDirsEntry)));
+    memcpy(data_dirs.data(), head + triage.dirs_offset, data_dirs.size() * sizeof(DataDirsEntry));
+
+    if (!hdr_coff.num_sections) {
+      return fail("Section table is empty");
+    }
+
+    section_headers.resize(hdr_coff.num_sections);
+
+    auto sectionsSize = section_headers.size() * sizeof(SectionHeadersEntry);
+    if (triage.sections_offset + sectionsSize <= size) {
+      memcpy(section_headers.data(), head + triage.sections_offset, sectionsSize);
+      return on_sections();
+    }
+
+    _scratch.resize(sectionsSize);
+    _stage = stage::sections;
+  }
+
+  void on_sections() {
+    auto& hdrCliEntry = data_dirs[CLI_HEADER_DATA_DIR];
+
+    DIAGNOSTICS(
+      std::cout << "CLI header meta:" << std::endl;
+      std::cout << "  size: " << hdrCliEntry.sz  << std::endl;
+      std::cout << "  rva:  " << hdrCliEntry.rva << std::endl;
+      std::cout << std::endl;
+
+      for (auto& entry : section_headers) {
+        std::cout << entry.name << " section:" << std::endl;
+        std::cout << "  V. size:  " << entry.sz_virt  << std::endl;
+        std::cout << "  V. addr:  " << entry.rva << std::endl;
+        std::cout << "  Raw size: " << entry.sz_raw   << std::endl;
+        std::cout << "  Raw addr: " << entry.file_offset  << std::endl;
+        std::cout << std::endl;
+      }
+    );
+
+    _cli_offset = find_file_offset(hdrCliEntry,
+      section_headers.begin(), section_headers.end());
+
+    if (_cli_offset < 0) {
+      return fail("CLI header is missing");
+    }
+
+    // The CLI header is usually within the triage window already.
+    if (_stage == stage::head && _cli_offset + sizeof(hdr_cli) <= _head_size) {
+      memcpy(&hdr_cli, _scratch.data() + _cli_offset, sizeof(hdr_cli));
+      return on_cli();
+    }
+
+    _stage = stage::cli;
+  }
+
+  void on_cli() {
+    _scratch.clear();
+    _scratch.shrink_to_fit();
+
+    DIAGNOSTICS(
+      std::cout << "CLI header:" << std::endl;
+      std::cout << "  size: " << hdr_cli.sz << std::endl;
+      std::cout << "  ver.: " << hdr_cli.rt_major << "." << hdr_cli.rt_minor << std::endl;
+      std::cout << std::endl;
+    );
+
+    meta_offset = find_file_offset(hdr_cli.meta,
+      section_headers.begin(), section_headers.end());
+
+    if (meta_offset < 0) {
+      return fail("Metadata is missing");
+    }
+
+    DIAGNOSTICS(
+      std::cout << "Metadata [0x" << std::hex << meta_offset << std::dec << "]" << std::endl;
+      std::cout << std::endl;
+    );
+
+    meta_size = hdr_cli.meta.sz;
+
+    // Headers may claim any size, a blob past the end of the file is not there.
+    auto fileSize = _mapping ? _mapping->size() : _file_size;
+    if (fileSize && size_t(meta_offset) + meta_size > fileSize) {
+      return fail("Metadata is missing");
+    }
+
+    if (_mapping) {
+      meta_data = _mapping->data() + meta_offset;
+      _stage = stage::done;
+      return;
+    }
+
+    if (_mem_limit && meta_size > _mem_limit) {
+      _error = "Memory budget exceeded";
+      _stage = stage::over_budget;
+      return;
+    }
+
+    // The whole metadata blob is fetched with one read and decoded from memory.
+    if (!meta_blob.allocate(meta_size)) {
+      return fail("Cannot allocate metadata buffer");
+    }
+
+    meta_data = meta_blob.data();
+    _stage = stage::metadata;
+  }
+};
+
+static bool load_image(const image_file& file, image_loader& loader) {
+  read_request req;
+  while (loader.next(req)) {
+    if (loader.current() == image_loader::stage::metadata) {
+      file.advise(req.offset, req.size, POSIX_FADV_WILLNEED);
+    }
+
+    loader.complete(file.read_some(req.offset, req.dst, req.size));
+  }
+
+  return loader.current() == image_loader::stage::done;
+}
+
+static bool load_image(const image_mapping& mapping, image_loader& loader) {
+  mapping.advise(0, TRIAGE_WINDOW, POSIX_MADV_WILLNEED);
+  loader.map(mapping);
+
+  read_request req;
+  while (loader.next(req)) {
+    loader.complete(mapping.read_some(req.offset, req.dst, req.size));
+  }
+
+  return loader.current() == image_loader::stage::done;
+}
+
+#endif // IMAGE_HPP_
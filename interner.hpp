@@ -0,0 +1,108 @@
+#pragma once
+
+#ifndef INTERNER_HPP_
+#define INTERNER_HPP_
+
+#include <array>
+#include <cstring>
+#include <functional>
+#include <memory>
+#include <mutex>
+#include <shared_mutex>
+#include <string_view>
+#include <unordered_map>
+#include <vector>
+
+#include "declarations.hpp"
+
+
+/*
+
+  Maps strings to compact ids, shared by all the workers of a batch run so
+  that a name that recurs across files ("System.Runtime", "List`1") is kept
+  once. Results hold ids only, text is looked up when it is written out.
+
+  Strings are spread over shards by hash, each one with its own lock; the
+  id carries the shard in its low bits. Text lives in append-only chunks,
+  so views returned by get() stay valid for the interner's lifetime.
+
+*/
+class string_interner {
+public:
+  static constexpr size_t SHARD_BITS = 6;
+  static constexpr size_t SHARDS = size_t(1) << SHARD_BITS;
+  static constexpr size_t CHUNK_SIZE = 64 * 1024;
+
+  dword intern(std::string_view s) {
+    auto index = std::hash<std::string_view>()(s) >> 7 & (SHARDS - 1);
+    auto& shard = _shards[index];
+
+    {
+      std::shared_lock<std::shared_mutex> guard(shard.lock);
+      auto found = shard.ids.find(s);
+      if (found != shard.ids.end()) {
+        return found->second;
+      }
+    }
+
+    std::unique_lock<std::shared_mutex> guard(shard.lock);
+
+    // Another worker may have added it in between the locks.
+    auto found = shard.ids.find(s);
+    if (found != shard.ids.end()) {
+      return found->second;
+    }
+
+    auto id = dword(shard.views.size() << SHARD_BITS | index);
+    auto stored = shard.store(s);
+
+    shard.views.push_back(stored);
+    shard.ids.emplace(stored, id);
+    return id;
+  }
+
+  std::string_view get(dword id) const {
+    auto& shard = _shards[id & (SHARDS - 1)];
+
+    std::shared_lock<std::shared_mutex> guard(shard.lock);
+    return shard.views[id >> SHARD_BITS];
+  }
+
+private:
+
+  struct alignas(64) shard {
+    mutable std::shared_mutex lock;
+    std::unordered_map<std::string_view, dword> ids;
+    std::vector<std::string_view> views;
+
+    std::vector<std::unique_ptr<char[]>> chunks;
+    size_t used = 0;
+
+    std::string_view store(std::string_view s) {
+      // Long strings get a chunk of their own.
+      if (s.size() > CHUNK_SIZE / 4) {
+        chunks.emplace_back(new char[s.size()]);
+        memcpy(chunks.back().get(), s.data(), s.size());
+        return std::string_view(chunks.back().get(), s.size());
+      }
+
+      if (!_current || CHUNK_SIZE - used < s.size()) {
+        chunks.emplace_back(new char[CHUNK_SIZE]);
+        _current = chunks.back().get();
+        used = 0;
+      }
+
+      auto dst = _current + used;
+      memcpy(dst, s.data(), s.size());
+      used += s.size();
+      return std::string_view(dst, s.size());
+    }
+
+  private:
+    char* _current = nullptr;
+  };
+
+  std::array<shard, SHARDS> _shards;
+};
+
+#endif // INTERNER_HPP_
@@ -0,0 +1,80 @@
+#pragma once
+
+#ifndef MEMBERS_HPP_
+#define MEMBERS_HPP_
+
+#include <utility>
+#include <vector>
+
+#include "declarations.hpp"
+#include "tables.hpp"
+#include "metadata.hpp"
+#include "signatures.hpp"
+
+
+/*
+
+  MemberRef rows bucketed by the TypeRef they are members of, so that the
+  members of every referenced type come out of one linear join.
+
+  The table is decoded once, the buckets are laid out with a counting sort
+  over the parent rows: counts, prefix sums, then a stable placement.
+  Members of instantiations (TypeSpec parents) go with their generic
+  TypeRef, rows with other parents (TypeDef, ModuleRef, ...) are left out.
+
+*/
+class member_refs_index {
+public:
+  explicit member_refs_index(const metadata& meta)
+    : _first(meta.rows_count(TableFlag::TypeRef) + 1) {
+
+    auto count = meta.rows_count(TableFlag::MemberRef);
+
+    std::vector<std::pair<dword, dword>> rows;   // parent TypeRef and MemberRef row
+    rows.reserve(count);
+
+    for (dword i = 0; i < count; ++i) {
+      MemberRefTable row;
+      meta.read_row(i, row);
+
+      TableFlag table;
+      auto parent = coded_index<MemberRefParent>::decode(row.cls, table);
+      if (table == TableFlag::TypeSpec) {
+        parent = signature_decoder::generic_type(meta, parent, table);
+      }
+
+      if (table == TableFlag::TypeRef && parent != NO_ROW) {
+        rows.emplace_back(parent, i);
+        ++_first[parent + 1];
+      }
+    }
+
+    for (size_t i = 1; i < _first.size(); ++i) {
+      _first[i] += _first[i - 1];
+    }
+
+    _rows.resize(rows.size());
+
+    std::vector<dword> next(_first.begin(), _first.end() - 1);
+    for (auto& row : rows) {
+      _rows[next[row.first]++] = row.second;
+    }
+  }
+
+  // 0-based MemberRef rows of a 0-based TypeRef row, in table order.
+  std::pair<const dword*, const dword*> members(dword typeRef) const {
+    return { _rows.data() + _first[typeRef], _rows.data() + _first[typeRef + 1] };
+  }
+
+  // Bytes taken while being built, for budgets.
+  static size_t footprint(const metadata& meta) {
+    return meta.rows_count(TableFlag::TypeRef) * 2 * sizeof(dword)
+      + meta.rows_count(TableFlag::MemberRef) * 3 * sizeof(dword);
+  }
+
+private:
+  std::vector<dword> _first;    // bucket starts by TypeRef row, plus the end
+  std::vector<dword> _rows;
+};
+
+#endif // MEMBERS_HPP_
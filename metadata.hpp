@@ -0,0 +1,798 @@
+#pragma once
+
+#ifndef METADATA_HPP_
+#define METADATA_HPP_
+
+#include <algorithm>
+#include <cstring>
+#include <map>
+#include <string>
+#include <vector>
+
+#include "declarations.hpp"
+#include "tables.hpp"
+#include "utility.hpp"
+#include "budget.hpp"
+#include "diag.hpp"
+
+
+static constexpr byte Unmapped = byte(-1);
+typedef byte TablesMapping[TABLES_MAX_COUNT];
+
+
+inline dword get_table_size(const TablesMapping& mapping, const dword size[], TableFlag table) {
+  return size[mapping[static_cast<size_t>(table)]];
+}
+
+inline size_t get_index_size_h(const MetadataHeader& hdr, HeapSizesFlags heap) {
+  return sizeof(word) << has_flag(hdr.heap_sizes, heap);
+}
+
+#define TABLE_INDEX_FIELD_SIZE_ESTIMATE(rowsCount, shift) \
+  (sizeof(word) << ((rowsCount) >= (dword(1) << (bitsizeof_(word) - (shift)))))
+inline size_t get_index_size_t(const TablesMapping& mapping, const dword size[], TableFlag table, int shift = 0) {
+  auto m = mapping[as_integral(table)];
+  return TABLE_INDEX_FIELD_SIZE_ESTIMATE(m != Unmapped ? size[m] : 0, shift);
+}
+
+// A 0-based row that is not there.
+static constexpr dword NO_ROW = dword(-1);
+
+template<class TCol>
+struct coded_index {
+
+  static constexpr dword mask = ~(dword(-1) << TCol::shift);
+
+  // Tags past the known tables (crafted images) decode to Undefined.
+  static constexpr dword decode(dword value, TableFlag& out_flag) {
+    auto tag = value & mask;
+    out_flag = tag < TCol::count ? TCol::m[tag] : TableFlag::Undefined;
+    return (value >> TCol::shift) - 1;
+  }
+
+  // The value of a 0-based row of the table tagged tag, as stored in the column.
+  static constexpr dword encode(dword tag, dword row) {
+    return (row + 1) << TCol::shift | tag;
+  }
+
+  static constexpr size_t get_size(const TablesMapping& mapping, const dword size[]) {
+    size_t result = 0;
+
+    for (auto t : TCol::m) {
+      if (t != TableFlag::Undefined) {
+        result = std::max(result, get_index_size_t(mapping, size, t, TCol::shift));
+      }
+    }
+
+    return result;
+  }
+
+  coded_index() = delete;
+};
+
+
+/*
+
+  In-memory view of the CLI metadata blob (ECMA-335 II.24).
+
+  The blob is expected to be loaded as a whole, every stream, heap
+  and table is then addressed by a plain pointer into it.
+
+  Both the optimized ("#~") and the uncompressed ("#-") tables streams
+  are understood. For the latter the pointer tables are resolved once
+  into remap arrays, list columns are then followed with list_row(),
+  and list_index() tells where in the lists a row of the table is.
+
+  Images are untrusted: read_metadata() checks the layout and the
+  columns of every table the tool decodes once, up front. Accessors
+  below do no checks of their own and rely on that.
+
+*/
+struct metadata {
+  const char* base = nullptr;
+  size_t size = 0;
+
+  MetadataRoot root;
+  std::string version;
+  std::map<std::string, StreamHeader> streams;
+
+  StreamHeader tables_stream;
+  bool uncompressed = false;    // "#-" rather than "#~"
+
+  MetadataHeader header;
+  TablesMapping mapping;
+  dword table_sizes[TABLES_MAX_COUNT];
+  const char* table_offsets[TABLES_MAX_COUNT];
+  IndexSize index_size;
+
+  const char* strings = nullptr;
+  const char* guids = nullptr;
+  const char* blobs = nullptr;
+  size_t strings_size = 0;
+  size_t guids_size = 0;
+  size_t blobs_size = 0;
+
+  // Physical 0-based rows by logical 0-based index, only for tables behind a pointer table.
+  std::vector<dword> remap[TABLES_MAX_COUNT];
+  // The other way around, NO_ROW for rows no pointer refers to.
+  std::vector<dword> unmap[TABLES_MAX_COUNT];
+
+  const StreamHeader* find_stream(const char* name) const {
+    auto found = streams.find(name);
+    return found != streams.end() ? &found->second : nullptr;
+  }
+
+  bool has_table(TableFlag table) const {
+    return as_integral(table) < TABLES_MAX_COUNT
+      && mapping[as_integral(table)] != Unmapped;
+  }
+
+  // Sorted by its primary key column, as the header claims.
+  bool is_sorted(TableFlag table) const {
+    return has_table(table) && is_bit_set(header.sorted, as_integral(table));
+  }
+
+  dword rows_count(TableFlag table) const {
+    return has_table(table) ? table_sizes[mapping[as_integral(table)]] : 0;
+  }
+
+  size_t row_size(TableFlag table) const {
+    return get_table_row_size(index_size, table);
+  }
+
+  // Row address by 0-based index.
+  const char* row(TableFlag table, dword index) const {
+    return table_offsets[mapping[as_integral(table)]]
+      + index * row_size(table);
+  }
+
+  // Row index a list column entry (TypeDef.FieldList etc.) resolves to, both 0-based.
+  dword list_row(TableFlag table, dword index) const {
+    auto& r = remap[as_integral(table)];
+    return r.empty() ? index : r[index];
+  }
+
+  // The inverse of list_row(): list entry of a 0-based row, NO_ROW if no list has it.
+  dword list_index(TableFlag table, dword row) const {
+    auto& r = unmap[as_integral(table)];
+    return r.empty() ? row : row < r.size() ? r[row] : NO_ROW;
+  }
+
+  // Number of list entries, the bound of the 0-based list columns.
+  dword list_size(TableFlag table) const {
+    auto& r = remap[as_integral(table)];
+    return r.empty() ? rows_count(table) : dword(r.size());
+  }
+
+  template<class TTable>
+  void read_row(dword index, TTable& dst) const {
+    typename TTable::meta meta(index_size);
+    meta.from_bytes(row(TTable::id, index), dst);
+  }
+
+  const char* get_string(dword index) const {
+    return strings + index;
+  }
+
+  void get_guid(dword index, guid& output) const {
+    memcpy(&output, guids + (index - 1) * sizeof(guid), sizeof(guid));
+  }
+
+  // Blob contents, index 0 is the empty blob even without a #Blob heap.
+  const char* get_blob(dword index, dword& length) const {
+    length = 0;
+    if (index == 0) {
+      return blobs;
+    }
+
+    auto header = read_blob_length(blobs + index, blobs_size - index, length);
+    return blobs + index + header;
+  }
+
+  /*
+
+    Compressed length in front of a blob (II.24.2.4), returns the size
+    of the length itself or 0 if it is malformed or does not fit.
+
+  */
+  static size_t read_blob_length(const char* src, size_t available, dword& length) {
+    auto p = reinterpret_cast<const byte*>(src);
+
+    if (available >= 1 && (p[0] & 0x80) == 0) {
+      length = p[0];
+      return 1;
+    }
+
+    if (available >= 2 && (p[0] & 0xC0) == 0x80) {
+      length = dword(p[0] & 0x3F) << 8 | p[1];
+      return 2;
+    }
+
+    if (available >= 4 && (p[0] & 0xE0) == 0xC0) {
+      length = dword(p[0] & 0x1F) << 24 | dword(p[1]) << 16 | dword(p[2]) << 8 | p[3];
+      return 4;
+    }
+
+    return 0;
+  }
+};
+
+// Resolves a pointer table into the remap and unmap arrays of the table it indirects to.
+template<class TPtr>
+static const char* read_pointer_table(metadata& dst, file_budget& budget, TableFlag target, dword TPtr::* column) {
+  auto& remap = dst.remap[as_integral(target)];
+  auto& unmap = dst.unmap[as_integral(target)];
+  remap.clear();
+  unmap.clear();
+
+  auto count = dst.rows_count(TPtr::id);
+  if (!count) {
+    return nullptr;
+  }
+
+  auto targetCount = dst.rows_count(target);
+  if (!budget.charge((count + targetCount) * sizeof(dword))) {
+    return budget.exceeded();
+  }
+
+  remap.resize(count);
+  unmap.assign(targetCount, NO_ROW);
+
+  for (dword i = 0; i < count; ++i) {
+    if (!budget.tick()) {
+      return budget.exceeded();
+    }
+
+    TPtr row;
+    dst.read_row(i, row);
+    remap[i] = row.*column - 1;
+
+    if (remap[i] >= targetCount) {
+      return "Pointer table is corrupt";
+    }
+
+    unmap[remap[i]] = i;
+  }
+
+  return nullptr;
+}
+
+
+static constexpr dword METADATA_SIGNATURE = 0x424A5342;
+static constexpr size_t METADATA_VERSION_MAX = 255;
+static constexpr size_t METADATA_STREAM_NAME_MAX = 32;
+static constexpr dword METADATA_ROWS_MAX = 0x00FFFFFF;   // tokens keep 24 bits for the row
+
+template<class TCol>
+bool is_valid_coded_index(const metadata& meta, dword value, bool nullable = false) {
+  if (value == 0) {
+    return nullable;
+  }
+
+  TableFlag table;
+  auto index = coded_index<TCol>::decode(value, table);
+  return index < meta.rows_count(table);
+}
+
+/*
+
+  Column checks for the tables that are actually decoded, so that the
+  readers never see a heap index or a row reference they cannot follow.
+  The #Strings heap is known to end with a zero byte by now, so an index
+  below its size is a valid C string.
+
+*/
+static const char* validate_tables(const metadata& meta, file_budget& budget) {
+  auto isString = [&meta] (dword index) {
+    return index < meta.strings_size;
+  };
+
+  auto isBlob = [&meta] (dword index) {
+    if (index == 0) {
+      return true;
+    }
+
+    dword length;
+    if (index >= meta.blobs_size) {
+      return false;
+    }
+
+    auto header = metadata::read_blob_length(meta.blobs + index, meta.blobs_size - index, length);
+    return header && length <= meta.blobs_size - index - header;
+  };
+
+  for (dword i = 0; i < meta.rows_count(TableFlag::Module); ++i) {
+    ModuleTable row;
+    meta.read_row(i, row);
+
+    if (!isString(row.name)
+        || row.id_module_version > meta.guids_size / sizeof(guid)) {
+      return "Module table is corrupt";
+    }
+  }
+
+  for (dword i = 0; i < meta.rows_count(TableFlag::TypeRef); ++i) {
+    if (!budget.tick()) {
+      return budget.exceeded();
+    }
+
+    TypeRefTable row;
+    meta.read_row(i, row);
+
+    if (!isString(row.type_name) || !isString(row.type_namespace)
+        || !is_valid_coded_index<ResolutionScope>(meta, row.resolution_scope, true)) {
+      return "TypeRef table is corrupt";
+    }
+  }
+
+  for (dword i = 0; i < meta.rows_count(TableFlag::TypeDef); ++i) {
+    if (!budget.tick()) {
+      return budget.exceeded();
+    }
+
+    TypeDefTable row;
+    meta.read_row(i, row);
+
+    if (!isString(row.type_name) || !isString(row.type_namespace)) {
+      return "TypeDef table is corrupt";
+    }
+  }
+
+  auto typeDefsCount = meta.rows_count(TableFlag::TypeDef);
+  for (dword i = 0; i < meta.rows_count(TableFlag::NestedClass); ++i) {
+    if (!budget.tick()) {
+      return budget.exceeded();
+    }
+
+    NestedClassTable row;
+    meta.read_row(i, row);
+
+    if (row.nested_class - 1 >= typeDefsCount || row.enclosing_class - 1 >= typeDefsCount) {
+      return "NestedClass table is corrupt";
+    }
+  }
+
+  for (dword i = 0; i < meta.rows_count(TableFlag::MemberRef); ++i) {
+    if (!budget.tick()) {
+      return budget.exceeded();
+    }
+
+    MemberRefTable row;
+    meta.read_row(i, row);
+
+    // Class is never null (II.22.25), the decoders take its row as it is.
+    if (!is_valid_coded_index<MemberRefParent>(meta, row.cls)
+        || !isString(row.name) || !isBlob(row.signature)) {
+      return "MemberRef table is corrupt";
+    }
+  }
+
+  for (dword i = 0; i < meta.rows_count(TableFlag::Field); ++i) {
+    if (!budget.tick()) {
+      return budget.exceeded();
+    }
+
+    FieldTable row;
+    meta.read_row(i, row);
+
+    if (!isString(row.name) || !isBlob(row.signature)) {
+      return "Field table is corrupt";
+    }
+  }
+
+  for (dword i = 0; i < meta.rows_count(TableFlag::MethodDef); ++i) {
+    if (!budget.tick()) {
+      return budget.exceeded();
+    }
+
+    MethodDefTable row;
+    meta.read_row(i, row);
+
+    if (!isString(row.name) || !isBlob(row.signature)) {
+      return "MethodDef table is corrupt";
+    }
+  }
+
+  for (dword i = 0; i < meta.rows_count(TableFlag::TypeSpec); ++i) {
+    if (!budget.tick()) {
+      return budget.exceeded();
+    }
+
+    TypeSpecTable row;
+    meta.read_row(i, row);
+
+    if (!isBlob(row.signature)) {
+      return "TypeSpec table is corrupt";
+    }
+  }
+
+  for (dword i = 0; i < meta.rows_count(TableFlag::MethodSpec); ++i) {
+    if (!budget.tick()) {
+      return budget.exceeded();
+    }
+
+    MethodSpecTable row;
+    meta.read_row(i, row);
+
+    if (!is_valid_coded_index<MethodDefOrRef>(meta, row.method) || !isBlob(row.instantiation)) {
+      return "MethodSpec table is corrupt";
+    }
+  }
+
+  for (dword i = 0; i < meta.rows_count(TableFlag::AssemblyRef); ++i) {
+    if (!budget.tick()) {
+      return budget.exceeded();
+    }
+
+    AssemblyRefTable row;
+    meta.read_row(i, row);
+
+    if (!isString(row.name) || !isString(row.culture) || !isBlob(row.public_key_or_token)) {
+      return "AssemblyRef table is corrupt";
+    }
+  }
+
+  for (dword i = 0; i < meta.rows_count(TableFlag::Assembly); ++i) {
+    AssemblyTable row;
+    meta.read_row(i, row);
+
+    if (!isString(row.name) || !isString(row.culture) || !isBlob(row.public_key)) {
+      return "Assembly table is corrupt";
+    }
+  }
+
+  for (dword i = 0; i < meta.rows_count(TableFlag::File); ++i) {
+    if (!budget.tick()) {
+      return budget.exceeded();
+    }
+
+    FileTable row;
+    meta.read_row(i, row);
+
+    if (!isString(row.name)) {
+      return "File table is corrupt";
+    }
+  }
+
+  for (dword i = 0; i < meta.rows_count(TableFlag::ExportedType); ++i) {
+    if (!budget.tick()) {
+      return budget.exceeded();
+    }
+
+    ExportedTypeTable row;
+    meta.read_row(i, row);
+
+    if (!isString(row.type_name) || !isString(row.type_namespace)
+        || !is_valid_coded_index<Implementation>(meta, row.implementation, true)) {
+      return "ExportedType table is corrupt";
+    }
+  }
+
+  for (dword i = 0; i < meta.rows_count(TableFlag::ModuleRef); ++i) {
+    if (!budget.tick()) {
+      return budget.exceeded();
+    }
+
+    ModuleRefTable row;
+    meta.read_row(i, row);
+
+    if (!isString(row.name)) {
+      return "ModuleRef table is corrupt";
+    }
+  }
+
+  // Parents are only compared with, never followed.
+  for (dword i = 0; i < meta.rows_count(TableFlag::CustomAttribute); ++i) {
+    if (!budget.tick()) {
+      return budget.exceeded();
+    }
+
+    CustomAttributeTable row;
+    meta.read_row(i, row);
+
+    if (!is_valid_coded_index<CustomAttributeType>(meta, row.type) || !isBlob(row.value)) {
+      return "CustomAttribute table is corrupt";
+    }
+  }
+
+  auto moduleRefsCount = meta.rows_count(TableFlag::ModuleRef);
+  for (dword i = 0; i < meta.rows_count(TableFlag::ImplMap); ++i) {
+    if (!budget.tick()) {
+      return budget.exceeded();
+    }
+
+    ImplMapTable row;
+    meta.read_row(i, row);
+
+    if (!is_valid_coded_index<MemberForwarded>(meta, row.member_forwarded)
+        || !isString(row.import_name) || row.import_scope - 1 >= moduleRefsCount) {
+      return "ImplMap table is corrupt";
+    }
+  }
+
+  for (dword i = 0; i < meta.rows_count(TableFlag::ManifestResource); ++i) {
+    if (!budget.tick()) {
+      return budget.exceeded();
+    }
+
+    ManifestResourceTable row;
+    meta.read_row(i, row);
+
+    if (!isString(row.name) || !is_valid_coded_index<Implementation>(meta, row.implementation, true)) {
+      return "ManifestResource table is corrupt";
+    }
+  }
+
+  return nullptr;
+}
+
+/*
+
+  Parses and validates the metadata blob, returns an error message
+  if it does not hold together (or the budget ran out) and nullptr otherwise.
+
+*/
+static const char* read_metadata(const char* base, size_t size, metadata& dst, file_budget& budget) {
+  dst.base = base;
+  dst.size = size;
+
+  const auto end = base + size;
+  auto fits = [end] (const char* p, size_t n) {
+    return n <= size_t(end - p);
+  };
+
+  auto p = base;
+
+  if (!fits(p, sizeof(dst.root))) {
+    return "Metadata root is truncated";
+  }
+
+  memcpy(&dst.root, p, sizeof(dst.root));
+  p += sizeof(dst.root);
+
+  if (dst.root.sig != METADATA_SIGNATURE) {
+    return "Bad metadata signature";
+  }
+
+  if (dst.root.sz_version > METADATA_VERSION_MAX
+      || !fits(p, round_up(4, size_t(dst.root.sz_version)) + 2 * sizeof(word))) {
+    return "Metadata root is truncated";
+  }
+
+  dst.version.assign(p, dst.root.sz_version);
+  p += round_up(4, size_t(dst.root.sz_version)) + sizeof(word);
+
+  dst.streams.clear();
+  {
+    word numStreams;
+    memcpy(&numStreams, p, sizeof(numStreams));
+    p += sizeof(numStreams);
+
+    DIAGNOSTICS(
+      std::cout << "Metadata root:" << std::endl;
+      std::cout << "  signature:     " << std::hex << std::showbase
+        << dst.root.sig << std::dec << std::endl;
+      std::cout << "  version:       " << dst.version << std::endl;
+      std::cout << "  streams count: " << numStreams << std::endl;
+      std::cout << std::endl;
+    );
+
+    StreamHeader entry;
+    for (; numStreams > 0; --numStreams) {
+      if (!fits(p, sizeof(entry))) {
+        return "Stream headers are truncated";
+      }
+
+      memcpy(&entry, p, sizeof(entry));
+      p += sizeof(entry);
+
+      auto nameEnd = static_cast<const char*>(
+        memchr(p, 0, std::min<size_t>(end - p, METADATA_STREAM_NAME_MAX)));
+      if (!nameEnd || !fits(p, round_up(4, size_t(nameEnd - p) + 1))) {
+        return "Stream headers are truncated";
+      }
+
+      if (entry.ofs > size || entry.sz > size - entry.ofs) {
+        return "Stream is out of range";
+      }
+
+      std::string streamName(p, nameEnd);
+      p += round_up(4, streamName.size() + 1);
+
+      dst.streams[streamName] = entry;
+
+      DIAGNOSTICS(
+        std::cout << streamName << " stream:" << std::endl;
+        std::cout << "  size:   " << entry.sz << std::endl;
+        std::cout << "  offset: " << entry.ofs << std::endl;
+        std::cout << std::endl;
+      );
+    }
+  }
+
+  auto streamHdrTables = dst.find_stream("#~");
+  dst.uncompressed = !streamHdrTables;
+  if (!streamHdrTables && !(streamHdrTables = dst.find_stream("#-"))) {
+    return "Metadata tables stream is missing";
+  }
+
+  dst.tables_stream = *streamHdrTables;
+
+  // Minimal EnC deltas mark all heap and table indices as 4-byte wide.
+  const bool largeIndices = dst.find_stream("#JTD") != nullptr;
+
+  p = base + streamHdrTables->ofs;
+  const auto tablesEnd = p + streamHdrTables->sz;
+  auto fitsTables = [tablesEnd] (const char* p, size_t n) {
+    return n <= size_t(tablesEnd - p);
+  };
+
+  if (!fitsTables(p, sizeof(dst.header))) {
+    return "Metadata tables stream is truncated";
+  }
+
+  memcpy(&dst.header, p, sizeof(dst.header));
+  p += sizeof(dst.header);
+
+  auto& hdrMeta = dst.header;
+
+  DIAGNOSTICS(
+    std::cout << "Metadata header:" << std::endl;
+    std::cout << "  version:         " << static_cast<int>(hdrMeta.ver_major) << "."
+      << static_cast<int>(hdrMeta.ver_minor) << std::endl;
+    std::cout << "  heap size flags: " << std::hex << std::showbase << static_cast<int>(hdrMeta.heap_sizes)
+      << std::dec << std::endl;
+    std::cout << "  reserve:         " << static_cast<int>(hdrMeta.reserved) << std::endl;
+    std::cout << "  valid:           " << std::bitset<64>(hdrMeta.valid) << std::endl;
+    std::cout << "  sorted:          " << std::bitset<64>(hdrMeta.sorted) << std::endl;
+    std::cout << "  has TypeRef?:    " << is_bit_set(hdrMeta.valid,
+      as_integral(TableFlag::TypeRef)) << std::endl;
+    std::cout << std::endl;
+  );
+
+  auto& tablesMapping = dst.mapping;
+  auto& tableSizes = dst.table_sizes;
+
+  std::fill(tablesMapping, tablesMapping + countof_(tablesMapping), Unmapped);
+  {
+    auto ctl = hdrMeta.valid;
+    for(size_t i = 0, j = 0; ctl; ctl >>= 1, ++j) {
+      if (ctl & 1) {
+        tablesMapping[j] = i++;
+      }
+    }
+  }
+
+  auto tablesCount = ones(hdrMeta.valid);
+  auto rowsCountsSize = tablesCount * sizeof(dword)
+    + (has_flag(hdrMeta.heap_sizes, HeapSizesFlags::ExtraData) ? sizeof(dword) : 0);
+  if (!fitsTables(p, rowsCountsSize)) {
+    return "Metadata tables stream is truncated";
+  }
+
+  memcpy(tableSizes, p, tablesCount * sizeof(dword));
+  p += rowsCountsSize;
+
+  for (size_t i = 0; i < tablesCount; ++i) {
+    if (tableSizes[i] > METADATA_ROWS_MAX) {
+      return "Metadata table rows count is out of range";
+    }
+  }
+
+  dst.index_size = {
+    { // heap
+      get_index_size_h(hdrMeta, HeapSizesFlags::Blob),
+      get_index_size_h(hdrMeta, HeapSizesFlags::Guid),
+      get_index_size_h(hdrMeta, HeapSizesFlags::String),
+    },
+    { // coded_cols
+      coded_index<CustomAttributeType> ::get_size(tablesMapping, tableSizes),
+      coded_index<HasConstant>         ::get_size(tablesMapping, tableSizes),
+      coded_index<HasCustomAttribute>  ::get_size(tablesMapping, tableSizes),
+      coded_index<HasDeclSecurity>     ::get_size(tablesMapping, tableSizes),
+      coded_index<HasFieldMarshal>     ::get_size(tablesMapping, tableSizes),
+      coded_index<HasSemantics>        ::get_size(tablesMapping, tableSizes),
+      coded_index<Implementation>      ::get_size(tablesMapping, tableSizes),
+      coded_index<MemberForwarded>     ::get_size(tablesMapping, tableSizes),
+      coded_index<MemberRefParent>     ::get_size(tablesMapping, tableSizes),
+      coded_index<MethodDefOrRef>      ::get_size(tablesMapping, tableSizes),
+      coded_index<ResolutionScope>     ::get_size(tablesMapping, tableSizes),
+      coded_index<TypeDefOrRef>        ::get_size(tablesMapping, tableSizes),
+      coded_index<TypeOrMethodDef>     ::get_size(tablesMapping, tableSizes),
+    },
+  };
+
+  for (size_t i = 0; i < countof_(tablesMapping); ++i) {
+    auto t = tablesMapping[i];
+    dst.index_size.plain_cols.m[i] = TABLE_INDEX_FIELD_SIZE_ESTIMATE(
+      t != Unmapped ? tableSizes[t] : 0, 0);
+  }
+
+  if (largeIndices) {
+    auto& is = dst.index_size;
+    is.heap.blob = is.heap.guid = is.heap.string = sizeof(dword);
+    std::fill(std::begin(is.coded_cols.m), std::end(is.coded_cols.m), sizeof(dword));
+    std::fill(std::begin(is.plain_cols.m), std::end(is.plain_cols.m), sizeof(dword));
+  }
+
+  DIAGNOSTICS(
+    std::stringstream tables;
+    tables << "table (" << tablesCount << ")";
+    std::cout << std::setw(25) << std::left  << tables.str();
+    std::cout << std::setw(8)  << std::right << "rows";
+    std::cout << std::setw(8)  << std::right << "size";
+    std::cout << std::setw(10) << std::right << "offset";
+    std::cout << std::endl;
+  );
+
+  {
+    auto cumulativeOffset = p;
+    for (size_t i = 0; i < countof_(tablesMapping); ++i) {
+      auto t = tablesMapping[i];
+
+      if (t != Unmapped) {
+        const auto tableRowsCount = tableSizes[t];
+        const auto tableFlag = TableFlag(i);
+        const auto tableSize = get_table_row_size(dst.index_size, tableFlag);
+
+        if (tableSize == size_t(-1)) {
+          return "Unknown metadata table";
+        }
+
+        // Both factors are small enough for the product not to overflow.
+        if (!fitsTables(cumulativeOffset, tableRowsCount * tableSize)) {
+          return "Metadata table is out of range";
+        }
+
+        dst.table_offsets[t] = cumulativeOffset;
+
+        DIAGNOSTICS(
+          std::cout << std::setfill('.') << std::setw(25) << std::left << tableFlag;
+          std::cout << std::setw(8) << std::internal << tableRowsCount;
+          std::cout << std::setw(8) << std::internal << tableSize;
+          std::cout << std::setw(10) << std::setfill('\0') << std::right
+            << std::hex << std::showbase << (cumulativeOffset - base) << std::dec;
+          std::cout << std::endl;
+        );
+
+        cumulativeOffset += tableRowsCount * tableSize;
+      }
+    }
+  }
+
+  DIAGNOSTICS(
+    std::cout << std::endl;
+  );
+
+  const char* error = nullptr;
+  if ((error = read_pointer_table(dst, budget, TableFlag::Field, &FieldPtrTable::field))
+      || (error = read_pointer_table(dst, budget, TableFlag::MethodDef, &MethodPtrTable::method))
+      || (error = read_pointer_table(dst, budget, TableFlag::Param, &ParamPtrTable::param))
+      || (error = read_pointer_table(dst, budget, TableFlag::Event, &EventPtrTable::event))
+      || (error = read_pointer_table(dst, budget, TableFlag::Property, &PropertyPtrTable::property))) {
+    return error;
+  }
+
+  if (auto streamHdrStrings = dst.find_stream("#Strings")) {
+    dst.strings = base + streamHdrStrings->ofs;
+    dst.strings_size = streamHdrStrings->sz;
+
+    if (dst.strings_size && dst.strings[dst.strings_size - 1] != '\0') {
+      return "#Strings heap is not terminated";
+    }
+  }
+
+  if (auto streamHdrGuid = dst.find_stream("#GUID")) {
+    dst.guids = base + streamHdrGuid->ofs;
+    dst.guids_size = streamHdrGuid->sz;
+  }
+
+  if (auto streamHdrBlob = dst.find_stream("#Blob")) {
+    dst.blobs = base + streamHdrBlob->ofs;
+    dst.blobs_size = streamHdrBlob->sz;
+  }
+
+  return validate_tables(dst, budget);
+}
+
+#endif // METADATA_HPP_
@@ -0,0 +1,380 @@
+#pragma once
+
+#ifndef REFS_FORMAT_HPP_
+#define REFS_FORMAT_HPP_
+
+#include <cstddef>
+#include <cstdint>
+#include <cstring>
+#include <deque>
+#include <map>
+#include <ostream>
+#include <string>
+#include <string_view>
+#include <tuple>
+#include <unordered_map>
+#include <vector>
+
+/*
+
+  Binary output (--binary): the type references of every file as columns
+  of integers, with every string stored once in a string table.
+
+  The header depends on the standard library only, consumers may take it
+  as is and read the output with refs_reader. All integers are u32,
+  little-endian.
+
+    header     magic "ASRF", version, sections count
+    section    id, payload size in bytes, payload (padded to 4 bytes)
+    ...
+
+  Sections come in this order, readers skip the ids they do not know:
+
+    STRINGS    count, offsets[count + 1], bytes
+               string i is bytes[offsets[i], offsets[i + 1]), UTF-8,
+               string 0 is always the empty one
+    FILES      count, path[count], kind[count], note[count]
+               string ids; kind is "managed", "r2r", ..., note is why
+               the file was skipped or failed, or the empty string
+    ASSEMBLIES count, name[count], version[count], culture[count], token[count]
+               string ids, each identity once; version is "1.2.3.4",
+               culture and public key token (hex) may be empty
+    REFS       count, file[count], assembly[count], type[count]
+               file indexes FILES, assembly ASSEMBLIES, type is a string id
+    MEMBERS    count, ref[count], name[count]
+               optional, only with --members; ref indexes REFS, name is
+               a string id, rows of one ref are contiguous
+
+*/
+
+static constexpr char     REFS_MAGIC[4] = { 'A', 'S', 'R', 'F' };
+static constexpr uint32_t REFS_VERSION = 2;
+
+enum class refs_section : uint32_t {
+  strings = 1,
+  files   = 2,
+  refs    = 3,
+  assemblies = 4,
+  members = 5,
+};
+
+struct refs_file {
+  uint32_t path, kind, note;
+};
+
+struct refs_assembly {
+  uint32_t name, version, culture, token;
+};
+
+struct refs_row {
+  uint32_t file, assembly, type;
+};
+
+struct refs_member {
+  uint32_t ref, name;
+};
+
+
+class refs_writer {
+public:
+  refs_writer() {
+    intern("");
+  }
+
+  uint32_t intern(std::string_view s) {
+    auto found = _ids.find(s);
+    if (found != _ids.end()) {
+      return found->second;
+    }
+
+    auto id = uint32_t(_offsets.size());
+    _offsets.push_back(uint32_t(_bytes.size()));
+    _bytes.append(s);
+
+    // Keys view the strings kept in a deque, which never moves them.
+    _ids.emplace(_strings.emplace_back(s), id);
+    return id;
+  }
+
+  uint32_t add_file(std::string_view path, std::string_view kind, std::string_view note) {
+    _files.push_back({ intern(path), intern(kind), intern(note) });
+    return uint32_t(_files.size() - 1);
+  }
+
+  uint32_t add_assembly(std::string_view name, std::string_view version,
+      std::string_view culture, std::string_view token) {
+    auto key = std::make_tuple(intern(name), intern(version), intern(culture), intern(token));
+
+    auto found = _assembly_ids.find(key);
+    if (found != _assembly_ids.end()) {
+      return found->second;
+    }
+
+    _assemblies.push_back({ std::get<0>(key), std::get<1>(key), std::get<2>(key), std::get<3>(key) });
+    return _assembly_ids[key] = uint32_t(_assemblies.size() - 1);
+  }
+
+  uint32_t add_ref(uint32_t file, uint32_t assembly, std::string_view type) {
+    _rows.push_back({ file, assembly, intern(type) });
+    return uint32_t(_rows.size() - 1);
+  }
+
+  void add_member(uint32_t ref, std::string_view name) {
+    _members.push_back({ ref, intern(name) });
+  }
+
+  void write(std::ostream& out) const {
+    out.write(REFS_MAGIC, sizeof(REFS_MAGIC));
+    put(out, REFS_VERSION);
+    put(out, _members.empty() ? 4 : 5);
+
+    auto count = uint32_t(_offsets.size());
+    section(out, refs_section::strings, (2 + count) * sizeof(uint32_t) + _bytes.size());
+    put(out, count);
+    for (auto ofs : _offsets) put(out, ofs);
+    put(out, uint32_t(_bytes.size()));
+    out.write(_bytes.data(), _bytes.size());
+    out.write("\0\0\0", padding(_bytes.size()));
+
+    section(out, refs_section::files, (1 + 3 * _files.size()) * sizeof(uint32_t));
+    put(out, uint32_t(_files.size()));
+    for (auto& f : _files) put(out, f.path);
+    for (auto& f : _files) put(out, f.kind);
+    for (auto& f : _files) put(out, f.note);
+
+    section(out, refs_section::assemblies, (1 + 4 * _assemblies.size()) * sizeof(uint32_t));
+    put(out, uint32_t(_assemblies.size()));
+    for (auto& a : _assemblies) put(out, a.name);
+    for (auto& a : _assemblies) put(out, a.version);
+    for (auto& a : _assemblies) put(out, a.culture);
+    for (auto& a : _assemblies) put(out, a.token);
+
+    section(out, refs_section::refs, (1 + 3 * _rows.size()) * sizeof(uint32_t));
+    put(out, uint32_t(_rows.size()));
+    for (auto& r : _rows) put(out, r.file);
+    for (auto& r : _rows) put(out, r.assembly);
+    for (auto& r : _rows) put(out, r.type);
+
+    if (!_members.empty()) {
+      section(out, refs_section::members, (1 + 2 * _members.size()) * sizeof(uint32_t));
+      put(out, uint32_t(_members.size()));
+      for (auto& m : _members) put(out, m.ref);
+      for (auto& m : _members) put(out, m.name);
+    }
+  }
+
+  static size_t padding(size_t size) {
+    return (4 - size % 4) % 4;
+  }
+
+private:
+  std::deque<std::string> _strings;
+  std::unordered_map<std::string_view, uint32_t> _ids;
+  std::vector<uint32_t> _offsets;
+  std::string _bytes;
+
+  std::vector<refs_file> _files;
+  std::vector<refs_assembly> _assemblies;
+  std::map<std::tuple<uint32_t, uint32_t, uint32_t, uint32_t>, uint32_t> _assembly_ids;
+  std::vector<refs_row> _rows;
+  std::vector<refs_member> _members;
+
+  static void put(std::ostream& out, uint32_t value) {
+    char bytes[4] = {
+      char(value), char(value >> 8), char(value >> 16), char(value >> 24) };
+    out.write(bytes, sizeof(bytes));
+  }
+
+  // The size given is that of the payload without padding.
+  static void section(std::ostream& out, refs_section id, size_t size) {
+    put(out, uint32_t(id));
+    put(out, uint32_t(size + padding(size)));
+  }
+};
+
+
+/*
+
+  Reads the output of refs_writer from memory, the buffer has to outlive
+  the reader. open() checks the layout once, accessors do not check.
+
+*/
+class refs_reader {
+public:
+  bool open(const char* data, size_t size) {
+    _strings = _files = _assemblies = _rows = _members = nullptr;
+    _members_count = 0;
+
+    if (size < 12 || memcmp(data, REFS_MAGIC, sizeof(REFS_MAGIC))
+        || get(data + 4) != REFS_VERSION) {
+      return false;
+    }
+
+    auto sections = get(data + 8);
+    size_t ofs = 12;
+
+    for (; sections > 0; --sections) {
+      if (size - ofs < 8) {
+        return false;
+      }
+
+      auto id = refs_section(get(data + ofs));
+      size_t length = get(data + ofs + 4);
+      ofs += 8;
+
+      if (length > size - ofs || length < sizeof(uint32_t)) {
+        return false;
+      }
+
+      auto payload = data + ofs;
+      size_t count = get(payload);
+
+      switch (id) {
+        case refs_section::strings:
+          if ((count + 2) * sizeof(uint32_t) > length) {
+            return false;
+          }
+          _strings_count = uint32_t(count);
+          _strings = payload + sizeof(uint32_t);
+          _bytes = _strings + (count + 1) * sizeof(uint32_t);
+          _bytes_size = length - (count + 2) * sizeof(uint32_t);
+          break;
+        case refs_section::files:
+          if ((1 + 3 * count) * sizeof(uint32_t) > length) {
+            return false;
+          }
+          _files_count = uint32_t(count);
+          _files = payload + sizeof(uint32_t);
+          break;
+        case refs_section::assemblies:
+          if ((1 + 4 * count) * sizeof(uint32_t) > length) {
+            return false;
+          }
+          _assemblies_count = uint32_t(count);
+          _assemblies = payload + sizeof(uint32_t);
+          break;
+        case refs_section::members:
+          if ((1 + 2 * count) * sizeof(uint32_t) > length) {
+            return false;
+          }
+          _members_count = uint32_t(count);
+          _members = payload + sizeof(uint32_t);
+          break;
+        case refs_section::refs:
+          if ((1 + 3 * count) * sizeof(uint32_t) > length) {
+            return false;
+          }
+          _rows_count = uint32_t(count);
+          _rows = payload + sizeof(uint32_t);
+          break;
+      }
+
+      ofs += length;
+    }
+
+    return _strings && _files && _assemblies && _rows && valid();
+  }
+
+  uint32_t strings_count() const { return _strings_count; }
+  uint32_t files_count() const { return _files_count; }
+  uint32_t assemblies_count() const { return _assemblies_count; }
+  uint32_t rows_count() const { return _rows_count; }
+  uint32_t members_count() const { return _members_count; }
+
+  std::string_view string(uint32_t id) const {
+    auto first = get(_strings + id * sizeof(uint32_t));
+    auto last = get(_strings + (id + 1) * sizeof(uint32_t));
+    return std::string_view(_bytes + first, last - first);
+  }
+
+  refs_file file(uint32_t index) const {
+    return { column(_files, _files_count, 0, index),
+      column(_files, _files_count, 1, index),
+      column(_files, _files_count, 2, index) };
+  }
+
+  refs_assembly assembly(uint32_t index) const {
+    return { column(_assemblies, _assemblies_count, 0, index),
+      column(_assemblies, _assemblies_count, 1, index),
+      column(_assemblies, _assemblies_count, 2, index),
+      column(_assemblies, _assemblies_count, 3, index) };
+  }
+
+  refs_row row(uint32_t index) const {
+    return { column(_rows, _rows_count, 0, index),
+      column(_rows, _rows_count, 1, index),
+      column(_rows, _rows_count, 2, index) };
+  }
+
+  refs_member member(uint32_t index) const {
+    return { column(_members, _members_count, 0, index),
+      column(_members, _members_count, 1, index) };
+  }
+
+private:
+  const char* _strings = nullptr;
+  const char* _bytes = nullptr;
+  const char* _files = nullptr;
+  const char* _assemblies = nullptr;
+  const char* _rows = nullptr;
+  const char* _members = nullptr;
+  size_t   _bytes_size = 0;
+  uint32_t _strings_count = 0;
+  uint32_t _files_count = 0;
+  uint32_t _assemblies_count = 0;
+  uint32_t _rows_count = 0;
+  uint32_t _members_count = 0;
+
+  static uint32_t get(const char* p) {
+    auto b = reinterpret_cast<const unsigned char*>(p);
+    return uint32_t(b[0]) | uint32_t(b[1]) << 8 | uint32_t(b[2]) << 16 | uint32_t(b[3]) << 24;
+  }
+
+  static uint32_t column(const char* base, uint32_t count, uint32_t col, uint32_t index) {
+    return get(base + (size_t(col) * count + index) * sizeof(uint32_t));
+  }
+
+  bool valid() const {
+    uint32_t previous = 0;
+    for (uint32_t i = 0; i <= _strings_count; ++i) {
+      auto ofs = get(_strings + i * sizeof(uint32_t));
+      if (ofs < previous || ofs > _bytes_size) {
+        return false;
+      }
+      previous = ofs;
+    }
+
+    for (uint32_t i = 0; i < _files_count; ++i) {
+      auto f = file(i);
+      if (f.path >= _strings_count || f.kind >= _strings_count || f.note >= _strings_count) {
+        return false;
+      }
+    }
+
+    for (uint32_t i = 0; i < _assemblies_count; ++i) {
+      auto a = assembly(i);
+      if (a.name >= _strings_count || a.version >= _strings_count
+          || a.culture >= _strings_count || a.token >= _strings_count) {
+        return false;
+      }
+    }
+
+    for (uint32_t i = 0; i < _rows_count; ++i) {
+      auto r = row(i);
+      if (r.file >= _files_count || r.assembly >= _assemblies_count || r.type >= _strings_count) {
+        return false;
+      }
+    }
+
+    for (uint32_t i = 0; i < _members_count; ++i) {
+      auto m = member(i);
+      if (m.ref >= _rows_count || m.name >= _strings_count) {
+        return false;
+      }
+    }
+
+    return true;
+  }
+};
+
+#endif // REFS_FORMAT_HPP_
@@ -0,0 +1,554 @@
+#pragma once
+
+#ifndef RESOLVER_HPP_
+#define RESOLVER_HPP_
+
+#include <algorithm>
+#include <iomanip>
+#include <map>
+#include <sstream>
+#include <string>
+#include <string_view>
+#include <unordered_map>
+#include <vector>
+
+#include "declarations.hpp"
+#include "tables.hpp"
+#include "metadata.hpp"
+
+
+static constexpr size_t RESOLUTION_DEPTH_MAX = 64;
+
+/*
+
+  Resolves TypeRef rows to their full names and to the scope the outermost
+  enclosing type lives in (AssemblyRef, Module or ModuleRef).
+
+  Every row is resolved at most once. A chain of enclosing TypeRefs is
+  walked iteratively, with the rows of the current pass marked in a visited
+  bitmap, so that a crafted scope loop or an absurdly deep nesting ends up
+  as a diagnostic and a broken entry instead of a hang.
+
+*/
+class type_ref_resolver {
+public:
+
+  struct type_ref {
+    std::string name;             // nested name first, then the enclosing ones
+    TableFlag scope = TableFlag::Undefined;
+    dword scope_row = NO_ROW;     // 0-based row in scope
+    dword enclosing = NO_ROW;     // 0-based TypeRef row of the enclosing type, if nested
+    dword type_name = 0;          // #Strings offsets of the row itself
+    dword type_namespace = 0;
+    bool broken = false;          // part of a scope loop or nested too deep
+  };
+
+  explicit type_ref_resolver(const metadata& meta)
+    : _meta(meta)
+    , _refs(meta.rows_count(TableFlag::TypeRef))
+    , _done(_refs.size())
+    , _visited(_refs.size()) {}
+
+  // Row is 0-based and known to be valid.
+  const type_ref& resolve(dword row) {
+    if (_done[row]) {
+      return _refs[row];
+    }
+
+    _path.clear();
+
+    auto current = row;
+    const char* problem = nullptr;
+    TableFlag scope = TableFlag::Undefined;
+    dword scopeRow = NO_ROW;
+
+    for (;;) {
+      if (_done[current]) {
+        scope = TableFlag::TypeRef;
+        scopeRow = current;
+        break;
+      }
+
+      if (_visited[current]) {
+        problem = "resolution scope loop";
+        break;
+      }
+
+      if (_path.size() == RESOLUTION_DEPTH_MAX) {
+        problem = "resolution scope nested too deep";
+        current = row;
+        break;
+      }
+
+      _visited[current] = true;
+      _path.push_back({ current, {} });
+
+      auto& entry = _path.back().table;
+      _meta.read_row(current, entry);
+
+      // A null scope is left undefined, the type is then found through ExportedType.
+      if (entry.resolution_scope == 0) {
+        break;
+      }
+
+      TableFlag table;
+      auto index = coded_index<ResolutionScope>::decode(entry.resolution_scope, table);
+      if (table != TableFlag::TypeRef) {
+        scope = table;
+        scopeRow = index;
+        break;
+      }
+
+      current = index;
+    }
+
+    if (problem) {
+      std::stringstream message;
+      message << "TypeRef 0x" << std::hex << std::setw(8) << std::setfill('0')
+        << (dword(as_integral(TableFlag::TypeRef)) << 24 | (current + 1))
+        << ": " << problem;
+      _diagnostics.push_back(message.str());
+    }
+
+    // Innermost rows come first, so the path is completed from its tail.
+    for (auto it = _path.rbegin(); it != _path.rend(); ++it) {
+      auto& dst = _refs[it->row];
+      auto& entry = it->table;
+
+      dst.type_name = entry.type_name;
+      dst.type_namespace = entry.type_namespace;
+
+      if (entry.type_namespace != 0) {
+        dst.name.assign(_meta.get_string(entry.type_namespace)).append(".");
+      }
+      dst.name.append(_meta.get_string(entry.type_name));
+
+      if (problem) {
+        dst.broken = true;
+      } else if (scope == TableFlag::TypeRef) {
+        auto& enclosing = _refs[scopeRow];
+        dst.enclosing = scopeRow;
+        dst.name.append(".").append(enclosing.name);
+        dst.scope = enclosing.scope;
+        dst.scope_row = enclosing.scope_row;
+        dst.broken = enclosing.broken;
+      } else {
+        dst.scope = scope;
+        dst.scope_row = scopeRow;
+      }
+
+      _visited[it->row] = false;
+      _done[it->row] = true;
+
+      scope = TableFlag::TypeRef;
+      scopeRow = it->row;
+    }
+
+    return _refs[row];
+  }
+
+  const std::vector<std::string>& diagnostics() const {
+    return _diagnostics;
+  }
+
+private:
+
+  struct path_entry {
+    dword row;
+    TypeRefTable table;
+  };
+
+  const metadata& _meta;
+
+  std::vector<type_ref> _refs;
+  std::vector<bool> _done;
+  std::vector<bool> _visited;
+  std::vector<path_entry> _path;
+  std::vector<std::string> _diagnostics;
+};
+
+
+/*
+
+  Full names of TypeDef rows, nested ones with their enclosing types
+  appended the same way as for TypeRefs.
+
+  The enclosing type of a row comes from NestedClass: a binary search when
+  the header marks the table sorted by its nested class column, as the
+  specification asks, otherwise a parent index built once. Chains are
+  walked like the TypeRef ones, bounded by the same visited bitmap.
+
+*/
+class type_def_resolver {
+public:
+  explicit type_def_resolver(const metadata& meta)
+    : _meta(meta)
+    , _names(meta.rows_count(TableFlag::TypeDef))
+    , _done(_names.size())
+    , _visited(_names.size())
+    , _sorted(meta.is_sorted(TableFlag::NestedClass)) {}
+
+  // Row is 0-based and known to be valid.
+  const std::string& resolve(dword row) {
+    if (_done[row]) {
+      return _names[row];
+    }
+
+    _path.clear();
+
+    auto current = row;
+    const char* problem = nullptr;
+    dword enclosingRow = NO_ROW;
+
+    for (;;) {
+      if (_done[current]) {
+        enclosingRow = current;
+        break;
+      }
+
+      if (_visited[current]) {
+        problem = "nesting loop";
+        break;
+      }
+
+      if (_path.size() == RESOLUTION_DEPTH_MAX) {
+        problem = "nested too deep";
+        current = row;
+        break;
+      }
+
+      _visited[current] = true;
+      _path.push_back(current);
+
+      auto next = enclosing(current);
+      if (next == NO_ROW) {
+        break;
+      }
+
+      current = next;
+    }
+
+    if (problem) {
+      std::stringstream message;
+      message << "TypeDef 0x" << std::hex << std::setw(8) << std::setfill('0')
+        << (dword(as_integral(TableFlag::TypeDef)) << 24 | (current + 1))
+        << ": " << problem;
+      _diagnostics.push_back(message.str());
+    }
+
+    // Innermost rows come first, so the path is completed from its tail.
+    for (auto it = _path.rbegin(); it != _path.rend(); ++it) {
+      TypeDefTable entry;
+      _meta.read_row(*it, entry);
+
+      auto& dst = _names[*it];
+      if (entry.type_namespace != 0) {
+        dst.assign(_meta.get_string(entry.type_namespace)).append(".");
+      }
+      dst.append(_meta.get_string(entry.type_name));
+
+      if (!problem && enclosingRow != NO_ROW) {
+        dst.append(".").append(_names[enclosingRow]);
+      }
+
+      _visited[*it] = false;
+      _done[*it] = true;
+
+      enclosingRow = *it;
+    }
+
+    return _names[row];
+  }
+
+  // 0-based TypeDef row the given one is nested in, or NO_ROW.
+  dword enclosing(dword row) {
+    auto count = _meta.rows_count(TableFlag::NestedClass);
+    NestedClassTable entry;
+
+    if (_sorted) {
+      dword first = 0, last = count;
+      while (first < last) {
+        auto middle = first + (last - first) / 2;
+        _meta.read_row(middle, entry);
+
+        if (entry.nested_class - 1 < row) {
+          first = middle + 1;
+        } else {
+          last = middle;
+        }
+      }
+
+      if (first < count) {
+        _meta.read_row(first, entry);
+        if (entry.nested_class - 1 == row) {
+          return entry.enclosing_class - 1;
+        }
+      }
+
+      return NO_ROW;
+    }
+
+    if (_parents.empty() && count) {
+      _parents.assign(_names.size(), NO_ROW);
+      for (dword i = 0; i < count; ++i) {
+        _meta.read_row(i, entry);
+        _parents[entry.nested_class - 1] = entry.enclosing_class - 1;
+      }
+    }
+
+    return _parents.empty() ? NO_ROW : _parents[row];
+  }
+
+  // 0-based TypeDef row owning a 0-based MethodDef row, NO_ROW if none does.
+  dword method_owner(dword method) const {
+    return owner(_meta.list_index(TableFlag::MethodDef, method), &TypeDefTable::method_list);
+  }
+
+  // Same for a 0-based Field row.
+  dword field_owner(dword field) const {
+    return owner(_meta.list_index(TableFlag::Field, field), &TypeDefTable::field_list);
+  }
+
+  const std::vector<std::string>& diagnostics() const {
+    return _diagnostics;
+  }
+
+private:
+  const metadata& _meta;
+
+  std::vector<std::string> _names;
+  std::vector<bool> _done;
+  std::vector<bool> _visited;
+  std::vector<dword> _path;
+  std::vector<dword> _parents;    // only when NestedClass is not sorted
+  std::vector<std::string> _diagnostics;
+  bool _sorted;
+
+  /*
+
+    Member lists are runs starting at MethodList or FieldList (II.22.37),
+    which grow along the table, so the owner of a member is the last row
+    starting at or before its list entry (see metadata::list_index()).
+
+  */
+  dword owner(dword member, dword TypeDefTable::* list) const {
+    if (member == NO_ROW) {
+      return NO_ROW;
+    }
+
+    dword first = 0, last = dword(_names.size());
+    TypeDefTable entry;
+
+    while (first < last) {
+      auto middle = first + (last - first) / 2;
+      _meta.read_row(middle, entry);
+
+      if (entry.*list - 1 <= member) {
+        first = middle + 1;
+      } else {
+        last = middle;
+      }
+    }
+
+    return first ? first - 1 : NO_ROW;
+  }
+};
+
+
+/*
+
+  Assemblies the scopes of resolved TypeRefs stand for: an AssemblyRef row,
+  the image's own assembly (SELF) or NO_ROW when it cannot be told. A
+  netmodule has no Assembly row, its own assembly is the module then.
+
+  Module scopes are the image's own assembly. ModuleRef and null scopes
+  are looked up in ExportedType first, which may forward the type to an
+  AssemblyRef or place it in one of the assembly's files; otherwise a
+  ModuleRef naming one of the File rows is the image's own assembly too.
+
+*/
+class scope_resolver {
+public:
+  static constexpr dword SELF = dword(-2);
+
+  scope_resolver(const metadata& meta, type_ref_resolver& resolver)
+    : _meta(meta), _resolver(resolver) {}
+
+  // For rows that are not broken only, so nesting is bounded.
+  dword assembly(dword row) {
+    auto& ref = _resolver.resolve(row);
+
+    switch (ref.scope) {
+      case TableFlag::AssemblyRef:
+        return ref.scope_row;
+      case TableFlag::Module:
+        return SELF;
+      case TableFlag::ModuleRef:
+      case TableFlag::Undefined:
+        break;
+      default:
+        return NO_ROW;
+    }
+
+    auto outermost = row;
+    while (_resolver.resolve(outermost).enclosing != NO_ROW) {
+      outermost = _resolver.resolve(outermost).enclosing;
+    }
+
+    auto& top = _resolver.resolve(outermost);
+    auto exported = find_exported(top.type_namespace, top.type_name);
+    if (exported != NO_ROW) {
+      return exported;
+    }
+
+    if (ref.scope == TableFlag::ModuleRef && is_file(ref.scope_row)) {
+      return SELF;
+    }
+
+    return NO_ROW;
+  }
+
+private:
+  typedef std::pair<std::string_view, std::string_view> full_name;
+
+  const metadata& _meta;
+  type_ref_resolver& _resolver;
+
+  bool _indexed = false;
+  std::map<full_name, dword> _exported;     // top level ExportedTypes to their assemblies
+  std::vector<std::string_view> _files;
+
+  // Built on first use, most images never need them.
+  void index() {
+    if (_indexed) {
+      return;
+    }
+    _indexed = true;
+
+    for (dword i = 0; i < _meta.rows_count(TableFlag::ExportedType); ++i) {
+      ExportedTypeTable row;
+      _meta.read_row(i, row);
+
+      if (row.implementation == 0) {
+        continue;
+      }
+
+      TableFlag table;
+      auto index = coded_index<Implementation>::decode(row.implementation, table);
+
+      dword assembly;
+      switch (table) {
+        case TableFlag::AssemblyRef: assembly = index; break;
+        case TableFlag::File:        assembly = SELF; break;
+        default: continue;  // nested ones, lookups are by the outermost type
+      }
+
+      _exported.emplace(full_name(_meta.get_string(row.type_namespace),
+        _meta.get_string(row.type_name)), assembly);
+    }
+
+    for (dword i = 0; i < _meta.rows_count(TableFlag::File); ++i) {
+      FileTable row;
+      _meta.read_row(i, row);
+      _files.push_back(_meta.get_string(row.name));
+    }
+  }
+
+  dword find_exported(dword typeNamespace, dword typeName) {
+    index();
+
+    auto found = _exported.find(full_name(_meta.get_string(typeNamespace), _meta.get_string(typeName)));
+    return found != _exported.end() ? found->second : NO_ROW;
+  }
+
+  bool is_file(dword moduleRef) {
+    index();
+
+    ModuleRefTable row;
+    _meta.read_row(moduleRef, row);
+
+    std::string_view name = _meta.get_string(row.name);
+    return std::find(_files.begin(), _files.end(), name) != _files.end();
+  }
+};
+
+
+struct heap_key {
+  dword a, b, c;
+
+  bool operator ==(const heap_key& other) const {
+    return a == other.a && b == other.b && c == other.c;
+  }
+
+  struct hash {
+    size_t operator()(const heap_key& key) const {
+      auto h = (qword(key.a) << 32 | key.b) * 0x9E3779B97F4A7C15ull;
+      return size_t((h ^ (h >> 29)) + key.c * 0xC2B2AE3D27D4EB4Full);
+    }
+  };
+};
+
+/*
+
+  First rows of AssemblyRefs and TypeRefs that name the same thing.
+
+  AssemblyRefs are the same assembly when name and public key (or token)
+  match, whatever the version and culture. TypeRefs are the same type when
+  namespace and name match and so do their scopes: the same assembly, or
+  the same enclosing type for nested ones. Everything is compared by heap
+  offsets, as compilers keep a single copy of equal strings and blobs.
+
+*/
+class ref_identities {
+public:
+  ref_identities(const metadata& meta, type_ref_resolver& resolver)
+    : _resolver(resolver)
+    , _assemblies(meta.rows_count(TableFlag::AssemblyRef))
+    , _types(meta.rows_count(TableFlag::TypeRef), NO_ROW) {
+
+    std::unordered_map<heap_key, dword, heap_key::hash> seen;
+    for (dword i = 0; i < _assemblies.size(); ++i) {
+      AssemblyRefTable row;
+      meta.read_row(i, row);
+
+      _assemblies[i] = seen.emplace(
+        heap_key{ row.name, row.public_key_or_token, 0 }, i).first->second;
+    }
+  }
+
+  dword assembly(dword row) const {
+    return _assemblies[row];
+  }
+
+  /*
+
+    For rows that are not broken only, so nesting is bounded. The assembly
+    is the canonical one the row's outermost type lives in, AssemblyRef
+    rows count or above for assemblies other than AssemblyRefs.
+
+  */
+  dword type(dword row, dword assembly) {
+    if (_types[row] != NO_ROW) {
+      return _types[row];
+    }
+
+    auto& ref = _resolver.resolve(row);
+
+    // Top level and nested types cannot clash, the scope's top bit tells them apart.
+    auto scope = ref.enclosing != NO_ROW
+      ? type(ref.enclosing, assembly) | 0x80000000u
+      : assembly;
+
+    return _types[row] = _seen.emplace(
+      heap_key{ scope, ref.type_namespace, ref.type_name }, row).first->second;
+  }
+
+private:
+  type_ref_resolver& _resolver;
+
+  std::vector<dword> _assemblies;
+  std::vector<dword> _types;
+  std::unordered_map<heap_key, dword, heap_key::hash> _seen;
+};
+
+#endif // RESOLVER_HPP_
@@ -0,0 +1,144 @@
+#pragma once
+
+#ifndef RESOURCES_HPP_
+#define RESOURCES_HPP_
+
+#include <cerrno>
+#include <cstring>
+
+#include <sys/sendfile.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
+#include "declarations.hpp"
+#include "image.hpp"
+
+
+// Byte range of a resource within its image file.
+struct resource_range {
+  off_t  offset = -1;
+  size_t size = 0;
+};
+
+/*
+
+  Resources embedded in a mapped image: the directory the CLI header points
+  to (II.25.3.3) holds them back to back, each one prefixed with its length,
+  at the offsets of the ManifestResource rows (II.22.24) whose
+  Implementation is null.
+
+*/
+class embedded_resources {
+public:
+  embedded_resources(const image_loader& image, const image_mapping& mapping)
+    : _size(image.hdr_cli.resources.sz), _mapping(mapping) {
+
+    auto& dir = image.hdr_cli.resources;
+    if (!try_find_file_offset(dir, image.section_headers.begin(), image.section_headers.end(), _offset)
+        || _offset < 0 || size_t(_offset) > mapping.size() || _size > mapping.size() - size_t(_offset)) {
+      _offset = -1;
+      _size = 0;
+    }
+  }
+
+  // The range of the resource at offset in the directory, false if it does not fit there.
+  bool find(dword offset, resource_range& out) const {
+    dword length;
+    if (_offset < 0 || offset > _size || _size - offset < sizeof(length)) {
+      return false;
+    }
+
+    memcpy(&length, _mapping.data() + _offset + offset, sizeof(length));
+    if (length > _size - offset - sizeof(length)) {
+      return false;
+    }
+
+    out.offset = _offset + offset + off_t(sizeof(length));
+    out.size = length;
+    return true;
+  }
+
+private:
+  off_t _offset = -1;
+  dword _size;
+  const image_mapping& _mapping;
+};
+
+/*
+
+  Copies a range of the file in to out without passing it through user
+  space: copy_file_range between regular files, which lets the file system
+  share extents, sendfile to anything else such as a pipe. Either falls
+  back to the next one when the kernel does not take the pair of files,
+  down to plain reads and writes. Returns false on error, errno tells.
+
+*/
+static bool copy_range(int in, off_t offset, size_t size, int out) {
+  struct stat st;
+  bool regular = !fstat(out, &st) && S_ISREG(st.st_mode);
+
+  enum { COPY_FILE_RANGE, SENDFILE, READ_WRITE } method = regular ? COPY_FILE_RANGE : SENDFILE;
+  size_t copied = 0;
+
+  while (copied < size) {
+    ssize_t n;
+
+    switch (method) {
+      case COPY_FILE_RANGE: {
+        loff_t from = offset + off_t(copied);
+        n = copy_file_range(in, &from, out, nullptr, size - copied, 0);
+        break;
+      }
+
+      case SENDFILE: {
+        off_t from = offset + off_t(copied);
+        n = sendfile(out, in, &from, size - copied);
+        break;
+      }
+
+      default: {
+        char buffer[64 * 1024];
+        n = pread(in, buffer, std::min(sizeof(buffer), size - copied), offset + off_t(copied));
+        if (n > 0) {
+          for (ssize_t written = 0; written < n;) {
+            auto w = write(out, buffer + written, size_t(n - written));
+            if (w < 0 && errno == EINTR) {
+              continue;
+            }
+            if (w <= 0) {
+              return false;
+            }
+            written += w;
+          }
+        }
+        break;
+      }
+    }
+
+    if (n < 0 && errno == EINTR) {
+      continue;
+    }
+
+    // Cross-device copies, file systems and files the call does not support.
+    if (n < 0 && method != READ_WRITE
+        && (errno == EXDEV || errno == EINVAL || errno == ENOSYS || errno == EOPNOTSUPP || errno == EBADF)) {
+      method = method == COPY_FILE_RANGE ? SENDFILE : READ_WRITE;
+      continue;
+    }
+
+    if (n < 0) {
+      return false;
+    }
+
+    if (n == 0) {
+      errno = EIO;  // the file is shorter than its headers say
+      return false;
+    }
+
+    copied += size_t(n);
+  }
+
+  return true;
+}
+
+#endif // RESOURCES_HPP_
@@ -1,5 +1,5 @@
 #!/bin/sh
 
 . ./prepare_.sh
-g++ -x c++ --std=c++17 $CC_FLAGS -mpopcnt -O2 -o build/assembly assembly.cpp\
+g++ -x c++ --std=c++17 $CC_FLAGS -mpopcnt -pthread -O2 -o build/assembly assembly.cpp\
 	&& $APP "$DLL"
\ No newline at end of file
@@ -0,0 +1,126 @@
+#pragma once
+
+#ifndef SHA1_HPP_
+#define SHA1_HPP_
+
+#include <algorithm>
+#include <cstddef>
+#include <cstring>
+
+#include "declarations.hpp"
+
+
+/*
+
+  SHA-1 (FIPS 180-4), needed only to turn full public keys into their
+  tokens: the last 8 bytes of the key's hash, in reverse order (II.6.3).
+
+*/
+class sha1 {
+public:
+  static constexpr size_t DIGEST_SIZE = 20;
+  static constexpr size_t BLOCK_BYTES = 64;
+
+  void update(const void* data, size_t size) {
+    auto p = static_cast<const byte*>(data);
+    _length += size;
+
+    if (_used) {
+      auto n = std::min(size, BLOCK_BYTES - _used);
+      memcpy(_block + _used, p, n);
+      _used += n;
+      p += n;
+      size -= n;
+
+      if (_used < BLOCK_BYTES) {
+        return;
+      }
+
+      transform(_block);
+      _used = 0;
+    }
+
+    for (; size >= BLOCK_BYTES; p += BLOCK_BYTES, size -= BLOCK_BYTES) {
+      transform(p);
+    }
+
+    memcpy(_block, p, size);
+    _used = size;
+  }
+
+  void finish(byte (&digest)[DIGEST_SIZE]) {
+    auto bits = _length * 8;
+
+    _block[_used++] = 0x80;
+    if (_used > BLOCK_BYTES - sizeof(qword)) {
+      memset(_block + _used, 0, BLOCK_BYTES - _used);
+      transform(_block);
+      _used = 0;
+    }
+
+    memset(_block + _used, 0, BLOCK_BYTES - sizeof(qword) - _used);
+    for (size_t i = 0; i < sizeof(qword); ++i) {
+      _block[BLOCK_BYTES - 1 - i] = byte(bits >> (i * 8));
+    }
+    transform(_block);
+
+    for (size_t i = 0; i < DIGEST_SIZE; ++i) {
+      digest[i] = byte(_h[i / 4] >> (24 - i % 4 * 8));
+    }
+  }
+
+private:
+  dword _h[5] = { 0x67452301, 0xEFCDAB89, 0x98BADCFE, 0x10325476, 0xC3D2E1F0 };
+  byte  _block[BLOCK_BYTES];
+  size_t _used = 0;
+  qword _length = 0;
+
+  static dword rol(dword x, int n) {
+    return (x << n) | (x >> (32 - n));
+  }
+
+  void transform(const byte* block) {
+    dword w[80];
+    for (int i = 0; i < 16; ++i) {
+      w[i] = dword(block[i * 4]) << 24 | dword(block[i * 4 + 1]) << 16
+        | dword(block[i * 4 + 2]) << 8 | block[i * 4 + 3];
+    }
+    for (int i = 16; i < 80; ++i) {
+      w[i] = rol(w[i - 3] ^ w[i - 8] ^ w[i - 14] ^ w[i - 16], 1);
+    }
+
+    auto a = _h[0], b = _h[1], c = _h[2], d = _h[3], e = _h[4];
+
+    for (int i = 0; i < 80; ++i) {
+      dword f, k;
+      if (i < 20) {
+        f = (b & c) | (~b & d);
+        k = 0x5A827999;
+      } else if (i < 40) {
+        f = b ^ c ^ d;
+        k = 0x6ED9EBA1;
+      } else if (i < 60) {
+        f = (b & c) | (b & d) | (c & d);
+        k = 0x8F1BBCDC;
+      } else {
+        f = b ^ c ^ d;
+        k = 0xCA62C1D6;
+      }
+
+      auto t = rol(a, 5) + f + e + k + w[i];
+      e = d;
+      d = c;
+      c = rol(b, 30);
+      b = a;
+      a = t;
+    }
+
+    _h[0] += a;
+    _h[1] += b;
+    _h[2] += c;
+    _h[3] += d;
+    _h[4] += e;
+  }
+};
+
+#endif // SHA1_HPP_
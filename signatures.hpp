@@ -0,0 +1,549 @@
+#pragma once
+
+#ifndef SIGNATURES_HPP_
+#define SIGNATURES_HPP_
+
+#include <cstring>
+#include <string>
+#include <string_view>
+#include <unordered_map>
+
+#include "declarations.hpp"
+#include "metadata.hpp"
+#include "resolver.hpp"
+
+
+/*
+
+  Cursor over one blob of the #Blob heap (II.23.2), it views the heap and
+  copies nothing. Reads past the end of the blob leave it failed; values
+  read then are zeros, so callers check ok() once at the end.
+
+*/
+class blob_reader {
+public:
+  blob_reader() = default;
+
+  blob_reader(const metadata& meta, dword index) {
+    dword length;
+    auto data = reinterpret_cast<const byte*>(meta.get_blob(index, length));
+    _p = data;
+    _end = data + length;
+  }
+
+  bool ok() const { return _ok; }
+  bool empty() const { return _p == _end; }
+
+  // Marks the blob malformed, for errors only the caller can see.
+  byte fail() {
+    _ok = false;
+    _p = _end;
+    return 0;
+  }
+
+  byte read_byte() {
+    if (_p == _end) {
+      return fail();
+    }
+
+    return *_p++;
+  }
+
+  byte peek_byte() const {
+    return _p != _end ? *_p : 0;
+  }
+
+  /*
+
+    Compressed unsigned integer: the top bits of the first byte give the
+    length (0xxxxxxx one byte, 10xxxxxx two, 110xxxxx four), looked up
+    rather than branched on.
+
+  */
+  dword read_compressed() {
+    static constexpr byte lengths[8] = { 1, 1, 1, 1, 2, 2, 4, 0 };
+    static constexpr dword masks[5] = { 0, 0x7F, 0x3FFF, 0, 0x1FFFFFFF };
+
+    size_t length = _p != _end ? lengths[*_p >> 5] : 0;
+    if (!length || size_t(_end - _p) < length) {
+      return fail();
+    }
+
+    dword value = 0;
+    for (size_t i = 0; i < length; ++i) {
+      value = value << 8 | _p[i];
+    }
+
+    _p += length;
+    return value & masks[length];
+  }
+
+  // Compressed signed integer (array lower bounds): rotated, sign bit lowest.
+  int read_compressed_signed() {
+    static constexpr byte lengths[8] = { 1, 1, 1, 1, 2, 2, 4, 0 };
+    static constexpr dword signs[5] = { 0, 0xFFFFFFC0, 0xFFFFE000, 0, 0xF0000000 };
+
+    size_t length = _p != _end ? lengths[*_p >> 5] : 0;
+    auto value = read_compressed();
+    if (!_ok) {
+      return 0;
+    }
+
+    return int(value & 1 ? (value >> 1) | signs[length] : value >> 1);
+  }
+
+  // TypeDefOrRefOrSpecEncoded (II.23.2.8): 0-based row and its table.
+  dword read_type_token(TableFlag& table) {
+    return coded_index<TypeDefOrRef>::decode(read_compressed(), table);
+  }
+
+  // Little-endian fixed size value, as in custom attribute blobs.
+  template<class T>
+  T read_value() {
+    T value = 0;
+    if (size_t(_end - _p) < sizeof(T)) {
+      fail();
+      return value;
+    }
+
+    memcpy(&value, _p, sizeof(T));
+    _p += sizeof(T);
+    return value;
+  }
+
+  // SerString (II.23.3): UTF-8 with a compressed length, 0xFF for null.
+  bool read_ser_string(std::string_view& out) {
+    if (peek_byte() == 0xFF) {
+      read_byte();
+      return false;
+    }
+
+    auto length = read_compressed();
+    if (size_t(_end - _p) < length) {
+      fail();
+      return false;
+    }
+
+    out = std::string_view(reinterpret_cast<const char*>(_p), length);
+    _p += length;
+    return true;
+  }
+
+private:
+  const byte* _p = nullptr;
+  const byte* _end = nullptr;
+  bool _ok = true;
+};
+
+
+static constexpr size_t SIGNATURE_DEPTH_MAX = RESOLUTION_DEPTH_MAX;
+static constexpr dword ARRAY_RANK_MAX = 32;
+static constexpr dword GENERIC_PARAMS_MAX = 64;
+
+enum class element_type : byte {
+  END = 0x00, VOID = 0x01, BOOLEAN = 0x02, CHAR = 0x03,
+  I1 = 0x04, U1 = 0x05, I2 = 0x06, U2 = 0x07, I4 = 0x08, U4 = 0x09,
+  I8 = 0x0A, U8 = 0x0B, R4 = 0x0C, R8 = 0x0D, STRING = 0x0E,
+  PTR = 0x0F, BYREF = 0x10, VALUETYPE = 0x11, CLASS = 0x12,
+  VAR = 0x13, ARRAY = 0x14, GENERICINST = 0x15, TYPEDBYREF = 0x16,
+  I = 0x18, U = 0x19, FNPTR = 0x1B, OBJECT = 0x1C, SZARRAY = 0x1D,
+  MVAR = 0x1E, CMOD_REQD = 0x1F, CMOD_OPT = 0x20,
+  SENTINEL = 0x41, PINNED = 0x45,
+};
+
+enum class signature_kind : byte {
+  HASTHIS = 0x20,
+  EXPLICITTHIS = 0x40,
+  GENERIC = 0x10,
+  VARARG = 0x05,
+  FIELD = 0x06,
+  LOCAL_SIG = 0x07,
+  PROPERTY = 0x08,
+  GENERICINST = 0x0A,
+  KIND_MASK = 0x0F,
+};
+
+/*
+
+  Renders signature blobs as text, C# keywords for the primitive types and
+  full names (as the resolvers build them) for the others:
+
+    System.Collections.Generic.List`1<System.Collections.Generic.Dictionary`2<string,int>>
+    bool TryGetValue(!0,!1&)
+
+  Class type parameters show as !n, method ones as !!n, custom modifiers
+  are left out. Everything is appended to one output string, so nothing
+  is allocated per node; names come from the memoized resolvers.
+
+  Generic instantiations (TypeSpec and MethodSpec blobs) are rendered once
+  per blob offset and kept, images refer to the same few over and over.
+
+*/
+class signature_decoder {
+public:
+  signature_decoder(const metadata& meta, type_ref_resolver& typeRefs, type_def_resolver& typeDefs)
+    : _meta(meta), _type_refs(typeRefs), _type_defs(typeDefs) {}
+
+  // A field or method signature together with the member name, false if it is malformed.
+  bool member(dword blob, std::string_view name, std::string& out) {
+    blob_reader reader(_meta, blob);
+    auto start = out.size();
+
+    auto kind = reader.read_byte();
+    auto callingConvention = kind & as_integral(signature_kind::KIND_MASK);
+
+    if (callingConvention == as_integral(signature_kind::FIELD)) {
+      type(reader, out, 0);
+      out.append(" ").append(name);
+    } else if (callingConvention <= as_integral(signature_kind::VARARG)) {
+      method(reader, kind, name, out);
+    } else {
+      reader.fail();
+    }
+
+    if (!reader.ok()) {
+      out.resize(start);
+      return false;
+    }
+
+    return true;
+  }
+
+  // A single type, false if it is malformed.
+  bool type(blob_reader& reader, std::string& out, size_t depth) {
+    if (depth == SIGNATURE_DEPTH_MAX) {
+      reader.fail();
+      return false;
+    }
+
+    auto e = element_type(reader.read_byte());
+
+    switch (e) {
+      case element_type::VOID:       out.append("void"); break;
+      case element_type::BOOLEAN:    out.append("bool"); break;
+      case element_type::CHAR:       out.append("char"); break;
+      case element_type::I1:         out.append("sbyte"); break;
+      case element_type::U1:         out.append("byte"); break;
+      case element_type::I2:         out.append("short"); break;
+      case element_type::U2:         out.append("ushort"); break;
+      case element_type::I4:         out.append("int"); break;
+      case element_type::U4:         out.append("uint"); break;
+      case element_type::I8:         out.append("long"); break;
+      case element_type::U8:         out.append("ulong"); break;
+      case element_type::R4:         out.append("float"); break;
+      case element_type::R8:         out.append("double"); break;
+      case element_type::STRING:     out.append("string"); break;
+      case element_type::OBJECT:     out.append("object"); break;
+      case element_type::I:          out.append("nint"); break;
+      case element_type::U:          out.append("nuint"); break;
+      case element_type::TYPEDBYREF: out.append("typedref"); break;
+
+      case element_type::PTR:
+        type(reader, out, depth + 1);
+        out.append("*");
+        break;
+
+      case element_type::BYREF:
+        type(reader, out, depth + 1);
+        out.append("&");
+        break;
+
+      case element_type::PINNED:
+        type(reader, out, depth + 1);
+        out.append(" pinned");
+        break;
+
+      case element_type::SZARRAY:
+        type(reader, out, depth + 1);
+        out.append("[]");
+        break;
+
+      case element_type::CMOD_REQD:
+      case element_type::CMOD_OPT: {
+        TableFlag table;
+        reader.read_type_token(table);
+        return type(reader, out, depth + 1);
+      }
+
+      case element_type::VALUETYPE:
+      case element_type::CLASS:
+        type_name(reader, out);
+        break;
+
+      case element_type::VAR:
+        out.append("!");
+        append_number(out, reader.read_compressed());
+        break;
+
+      case element_type::MVAR:
+        out.append("!!");
+        append_number(out, reader.read_compressed());
+        break;
+
+      case element_type::GENERICINST: {
+        auto kind = element_type(reader.read_byte());
+        if (kind != element_type::CLASS && kind != element_type::VALUETYPE) {
+          reader.fail();
+          return false;
+        }
+
+        type_name(reader, out);
+        arguments(reader, out, depth);
+        break;
+      }
+
+      case element_type::ARRAY: {
+        type(reader, out, depth + 1);
+
+        auto rank = reader.read_compressed();
+        auto sizes = reader.read_compressed();
+        for (dword i = 0; i < sizes && reader.ok(); ++i) {
+          reader.read_compressed();
+        }
+        auto bounds = reader.read_compressed();
+        for (dword i = 0; i < bounds && reader.ok(); ++i) {
+          reader.read_compressed_signed();
+        }
+
+        if (rank > ARRAY_RANK_MAX) {
+          reader.fail();
+          return false;
+        }
+
+        out.append("[");
+        out.append(rank ? rank - 1 : 0, ',');
+        out.append("]");
+        break;
+      }
+
+      case element_type::FNPTR: {
+        auto kind = reader.read_byte();
+        out.append("method ");
+        method(reader, kind, "*", out, depth + 1);
+        break;
+      }
+
+      default:
+        reader.fail();
+        return false;
+    }
+
+    return reader.ok();
+  }
+
+  // GENERICINST arguments, "<a,b>".
+  bool arguments(blob_reader& reader, std::string& out, size_t depth) {
+    auto count = reader.read_compressed();
+
+    out.append("<");
+    for (dword i = 0; i < count && reader.ok(); ++i) {
+      if (i) {
+        out.append(",");
+      }
+      type(reader, out, depth + 1);
+    }
+    out.append(">");
+
+    return reader.ok();
+  }
+
+  // A TypeSpec row (0-based) as a type, nullptr if its blob is malformed.
+  const std::string* type_spec(dword row) {
+    TypeSpecTable spec;
+    _meta.read_row(row, spec);
+
+    auto inserted = _type_specs.try_emplace(spec.signature);
+    auto& text = inserted.first->second;
+    if (inserted.second) {
+      blob_reader reader(_meta, spec.signature);
+      if (!type(reader, text, 0)) {
+        text.clear();
+      }
+    }
+
+    return text.empty() ? nullptr : &text;
+  }
+
+  // MethodSpec instantiation blob (II.23.2.15) as "<a,b>", nullptr if it is malformed.
+  const std::string* method_instantiation(dword blob) {
+    auto inserted = _method_specs.try_emplace(blob);
+    auto& text = inserted.first->second;
+    if (inserted.second) {
+      blob_reader reader(_meta, blob);
+      if (reader.read_byte() != as_integral(signature_kind::GENERICINST)
+          || !arguments(reader, text, 0)) {
+        text.clear();
+      }
+    }
+
+    return text.empty() ? nullptr : &text;
+  }
+
+  // TypeDef or TypeRef row (0-based) of the generic a TypeSpec row instantiates, NO_ROW if it is no instantiation.
+  static dword generic_type(const metadata& meta, dword typeSpec, TableFlag& table) {
+    TypeSpecTable spec;
+    meta.read_row(typeSpec, spec);
+
+    blob_reader reader(meta, spec.signature);
+    if (reader.read_byte() != as_integral(element_type::GENERICINST)) {
+      return NO_ROW;
+    }
+
+    auto kind = element_type(reader.read_byte());
+    if (kind != element_type::CLASS && kind != element_type::VALUETYPE) {
+      return NO_ROW;
+    }
+
+    auto row = reader.read_type_token(table);
+    if (!reader.ok() || table == TableFlag::TypeSpec || row >= meta.rows_count(table)) {
+      return NO_ROW;
+    }
+
+    return row;
+  }
+
+  /*
+
+    A MethodSpec row (0-based) as "Owner.Method<a,b>", false if it is
+    malformed. The TypeDef or TypeRef row of the type declaring the generic
+    method comes along, through the instantiated type for TypeSpec owners.
+
+  */
+  bool method_spec(dword row, std::string& out, TableFlag& table, dword& owner) {
+    MethodSpecTable spec;
+    _meta.read_row(row, spec);
+
+    auto arguments = method_instantiation(spec.instantiation);
+    if (!arguments) {
+      return false;
+    }
+
+    TableFlag methodTable;
+    auto method = coded_index<MethodDefOrRef>::decode(spec.method, methodTable);
+
+    const std::string* ownerName = nullptr;
+    dword name;
+
+    if (methodTable == TableFlag::MethodDef) {
+      MethodDefTable def;
+      _meta.read_row(method, def);
+      name = def.name;
+
+      table = TableFlag::TypeDef;
+      owner = _type_defs.method_owner(method);
+    } else {
+      MemberRefTable ref;
+      _meta.read_row(method, ref);
+      name = ref.name;
+
+      owner = coded_index<MemberRefParent>::decode(ref.cls, table);
+      if (!ref.cls || owner >= _meta.rows_count(table)) {
+        owner = NO_ROW;
+      } else if (table == TableFlag::TypeSpec) {
+        ownerName = type_spec(owner);
+        owner = ownerName ? generic_type(_meta, owner, table) : NO_ROW;
+      } else if (table != TableFlag::TypeRef && table != TableFlag::TypeDef) {
+        owner = NO_ROW;
+      }
+    }
+
+    if (owner == NO_ROW) {
+      return false;
+    }
+
+    if (!ownerName) {
+      ownerName = table == TableFlag::TypeRef ? &_type_refs.resolve(owner).name : &_type_defs.resolve(owner);
+    }
+
+    out.append(*ownerName).append(".").append(_meta.get_string(name)).append(*arguments);
+    return true;
+  }
+
+private:
+  const metadata& _meta;
+  type_ref_resolver& _type_refs;
+  type_def_resolver& _type_defs;
+
+  // Rendered instantiations by blob index, empty for malformed ones.
+  std::unordered_map<dword, std::string> _type_specs;
+  std::unordered_map<dword, std::string> _method_specs;
+
+  static void append_number(std::string& out, dword value) {
+    char digits[10];
+    size_t n = 0;
+    do {
+      digits[n++] = char('0' + value % 10);
+      value /= 10;
+    } while (value);
+
+    while (n) {
+      out += digits[--n];
+    }
+  }
+
+  void type_name(blob_reader& reader, std::string& out) {
+    TableFlag table;
+    auto row = reader.read_type_token(table);
+    if (!reader.ok() || row >= _meta.rows_count(table)) {
+      reader.fail();
+      return;
+    }
+
+    switch (table) {
+      case TableFlag::TypeRef:
+        out.append(_type_refs.resolve(row).name);
+        break;
+      case TableFlag::TypeDef:
+        out.append(_type_defs.resolve(row));
+        break;
+      default:
+        // TypeSpec rows are not allowed where a signature names a type.
+        reader.fail();
+    }
+  }
+
+  // MethodDefSig / MethodRefSig (II.23.2.1-2) after its first byte: "ret name<!!0>(a,b)".
+  void method(blob_reader& reader, byte kind, std::string_view name, std::string& out, size_t depth = 0) {
+    dword generics = 0;
+    if (kind & as_integral(signature_kind::GENERIC)) {
+      generics = reader.read_compressed();
+    }
+
+    auto count = reader.read_compressed();
+
+    type(reader, out, depth + 1);
+    out.append(" ").append(name);
+
+    if (generics > GENERIC_PARAMS_MAX) {
+      reader.fail();
+      return;
+    }
+
+    if (generics) {
+      out.append("<");
+      for (dword i = 0; i < generics; ++i) {
+        out.append(i ? ",!!" : "!!");
+        append_number(out, i);
+      }
+      out.append(">");
+    }
+
+    out.append("(");
+    for (dword i = 0; i < count && reader.ok(); ++i) {
+      if (i) {
+        out.append(",");
+      }
+
+      // Varargs call sites list the extra arguments after a sentinel.
+      if (reader.peek_byte() == as_integral(element_type::SENTINEL)) {
+        reader.read_byte();
+        out.append("...,");
+      }
+
+      type(reader, out, depth + 1);
+    }
+    out.append(")");
+  }
+};
+
+#endif // SIGNATURES_HPP_
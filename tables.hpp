@@ -3,6 +3,8 @@
 #ifndef TABLES_HPP_
 #define TABLES_HPP_
 
+#include <cstring>
+
 #include "declarations.hpp"
 #include "utility.hpp"
 
@@ -14,7 +16,8 @@ struct IndexSize {
   template<class T>
   struct get_val {
     static dword f(const char* (&d)) {
-      auto result = *reinterpret_cast<T*>(const_cast<char*>(d));
+      T result;
+      memcpy(&result, d, sizeof(T));
       d += sizeof(T);
       return result;
     }
@@ -167,6 +170,33 @@ struct TypeDefTable {
   }; 
 };
 
+/*
+
+  Pointer tables only appear in uncompressed ("#-") streams, where they
+  put an extra level of indirection between the list columns of TypeDef,
+  MethodDef, EventMap and PropertyMap and the rows they refer to.
+
+*/
+struct FieldPtrTable {
+  static constexpr TableFlag id = TableFlag::FieldPtr;
+
+  dword field;
+
+  struct meta : protected TableMeta_ {
+
+    meta(const IndexSize& hs)
+      : TableMeta_(hs) {}
+
+    void from_bytes(const char* src, FieldPtrTable& dst) const {
+      dst.field = _hs->plain_cols.get_idx_plain(src, TableFlag::Field);
+    }
+
+    size_t row_size() const {
+      return _hs->plain_cols[TableFlag::Field];
+    }
+  };
+};
+
 struct FieldTable {
   static constexpr TableFlag id = TableFlag::Field;
 
@@ -193,16 +223,50 @@ struct FieldTable {
   }; 
 };
 
+struct MethodPtrTable {
+  static constexpr TableFlag id = TableFlag::MethodPtr;
+
+  dword method;
+
+  struct meta : protected TableMeta_ {
+
+    meta(const IndexSize& hs)
+      : TableMeta_(hs) {}
+
+    void from_bytes(const char* src, MethodPtrTable& dst) const {
+      dst.method = _hs->plain_cols.get_idx_plain(src, TableFlag::MethodDef);
+    }
+
+    size_t row_size() const {
+      return _hs->plain_cols[TableFlag::MethodDef];
+    }
+  };
+};
+
 struct MethodDefTable {
   static constexpr TableFlag id = TableFlag::MethodDef;
 
-  // TODO: fields
+  dword rva;
+  word impl_flags;
+  word flags;
+  dword name;
+  dword signature;
+  dword param_list;
 
   struct meta : protected TableMeta_ {
 
     meta(const IndexSize& hs)
       : TableMeta_(hs) {}
 
+    void from_bytes(const char* src, MethodDefTable& dst) const {
+      dst.rva = IndexSize::get_val<dword>::f(src);
+      dst.impl_flags = IndexSize::get_val<word>::f(src);
+      dst.flags = IndexSize::get_val<word>::f(src);
+      dst.name = _hs->heap.get_idx_string(src);
+      dst.signature = _hs->heap.get_idx_blob(src);
+      dst.param_list = _hs->plain_cols.get_idx_plain(src, TableFlag::Param);
+    }
+
     size_t row_size() const {
       return sizeof(dword)
         + 2 * sizeof(word)
@@ -213,6 +277,26 @@ struct MethodDefTable {
   }; 
 };
 
+struct ParamPtrTable {
+  static constexpr TableFlag id = TableFlag::ParamPtr;
+
+  dword param;
+
+  struct meta : protected TableMeta_ {
+
+    meta(const IndexSize& hs)
+      : TableMeta_(hs) {}
+
+    void from_bytes(const char* src, ParamPtrTable& dst) const {
+      dst.param = _hs->plain_cols.get_idx_plain(src, TableFlag::Param);
+    }
+
+    size_t row_size() const {
+      return _hs->plain_cols[TableFlag::Param];
+    }
+  };
+};
+
 struct ParamTable {
   static constexpr TableFlag id = TableFlag::Param;
 
@@ -241,7 +325,7 @@ struct InterfaceImplTable {
       : TableMeta_(hs) {}
 
     size_t row_size() const {
-      return _hs->plain_cols[TableFlag::Param]
+      return _hs->plain_cols[TableFlag::TypeDef]
         + _hs->coded_cols[TypeDefOrRef::id];
     }
   };  
@@ -406,7 +490,7 @@ struct StandAloneSigTable {
       : TableMeta_(hs) {}
 
     size_t row_size() const {
-      return _hs->heap.string;
+      return _hs->heap.blob;
     }
   }; 
 };
@@ -428,6 +512,26 @@ struct EventMapTable {
   }; 
 };
 
+struct EventPtrTable {
+  static constexpr TableFlag id = TableFlag::EventPtr;
+
+  dword event;
+
+  struct meta : protected TableMeta_ {
+
+    meta(const IndexSize& hs)
+      : TableMeta_(hs) {}
+
+    void from_bytes(const char* src, EventPtrTable& dst) const {
+      dst.event = _hs->plain_cols.get_idx_plain(src, TableFlag::Event);
+    }
+
+    size_t row_size() const {
+      return _hs->plain_cols[TableFlag::Event];
+    }
+  };
+};
+
 struct EventTable {
   static constexpr TableFlag id = TableFlag::Event;
 
@@ -463,6 +567,26 @@ struct PropertyMapTable {
   }; 
 };
 
+struct PropertyPtrTable {
+  static constexpr TableFlag id = TableFlag::PropertyPtr;
+
+  dword property;
+
+  struct meta : protected TableMeta_ {
+
+    meta(const IndexSize& hs)
+      : TableMeta_(hs) {}
+
+    void from_bytes(const char* src, PropertyPtrTable& dst) const {
+      dst.property = _hs->plain_cols.get_idx_plain(src, TableFlag::Property);
+    }
+
+    size_t row_size() const {
+      return _hs->plain_cols[TableFlag::Property];
+    }
+  };
+};
+
 struct PropertyTable {
   static constexpr TableFlag id = TableFlag::Property;
 
@@ -539,13 +663,17 @@ struct ModuleRefTable {
 struct TypeSpecTable {
   static constexpr TableFlag id = TableFlag::TypeSpec;
 
-  // TODO: fields
+  dword signature;
 
   struct meta : protected TableMeta_ {
 
     meta(const IndexSize& hs)
       : TableMeta_(hs) {}
 
+    void from_bytes(const char* src, TypeSpecTable& dst) const {
+      dst.signature = _hs->heap.get_idx_blob(src);
+    }
+
     size_t row_size() const {
       return _hs->heap.blob;
     }
@@ -555,13 +683,23 @@ struct TypeSpecTable {
 struct ImplMapTable {
   static constexpr TableFlag id = TableFlag::ImplMap;
 
-  // TODO: fields
+  word mapping_flags;
+  dword member_forwarded;
+  dword import_name;
+  dword import_scope;
 
   struct meta : protected TableMeta_ {
 
     meta(const IndexSize& hs)
       : TableMeta_(hs) {}
 
+    void from_bytes(const char* src, ImplMapTable& dst) const {
+      dst.mapping_flags = IndexSize::get_val<word>::f(src);
+      dst.member_forwarded = _hs->coded_cols.get_idx_coded(src, MemberForwarded::id);
+      dst.import_name = _hs->heap.get_idx_string(src);
+      dst.import_scope = _hs->plain_cols.get_idx_plain(src, TableFlag::ModuleRef);
+    }
+
     size_t row_size() const {
       return sizeof(word)
         + _hs->coded_cols[MemberForwarded::id]
@@ -588,6 +726,38 @@ struct FieldRVATable {
   }; 
 };
 
+struct ENCLogTable {
+  static constexpr TableFlag id = TableFlag::ENCLog;
+
+  // TODO: fields
+
+  struct meta : protected TableMeta_ {
+
+    meta(const IndexSize& hs)
+      : TableMeta_(hs) {}
+
+    size_t row_size() const {
+      return 2 * sizeof(dword);
+    }
+  };
+};
+
+struct ENCMapTable {
+  static constexpr TableFlag id = TableFlag::ENCMap;
+
+  // TODO: fields
+
+  struct meta : protected TableMeta_ {
+
+    meta(const IndexSize& hs)
+      : TableMeta_(hs) {}
+
+    size_t row_size() const {
+      return sizeof(dword);
+    }
+  };
+};
+
 struct AssemblyTable {
   static constexpr TableFlag id = TableFlag::Assembly;
 
@@ -731,15 +901,23 @@ struct AssemblyRefOSTable {
 struct FileTable {
   static constexpr TableFlag id = TableFlag::File;
 
-  // TODO: fields
+  dword flags;
+  dword name;
+  dword hash_value;
 
   struct meta : protected TableMeta_ {
 
     meta(const IndexSize& hs)
       : TableMeta_(hs) {}
 
+    void from_bytes(const char* src, FileTable& dst) const {
+      dst.flags = IndexSize::get_val<dword>::f(src);
+      dst.name = _hs->heap.get_idx_string(src);
+      dst.hash_value = _hs->heap.get_idx_blob(src);
+    }
+
     size_t row_size() const {
-      return sizeof(word)
+      return sizeof(dword)
         + _hs->heap.string
         + _hs->heap.blob;
     }
@@ -749,13 +927,25 @@ struct FileTable {
 struct ExportedTypeTable {
   static constexpr TableFlag id = TableFlag::ExportedType;
 
-  // TODO: fields
+  dword flags;
+  dword type_def_id;
+  dword type_name;
+  dword type_namespace;
+  dword implementation;
 
   struct meta : protected TableMeta_ {
 
     meta(const IndexSize& hs)
       : TableMeta_(hs) {}
 
+    void from_bytes(const char* src, ExportedTypeTable& dst) const {
+      dst.flags = IndexSize::get_val<dword>::f(src);
+      dst.type_def_id = IndexSize::get_val<dword>::f(src);
+      dst.type_name = _hs->heap.get_idx_string(src);
+      dst.type_namespace = _hs->heap.get_idx_string(src);
+      dst.implementation = _hs->coded_cols.get_idx_coded(src, Implementation::id);
+    }
+
     size_t row_size() const {
       return 2 * sizeof(dword)
         + 2 * _hs->heap.string
@@ -767,13 +957,23 @@ struct ExportedTypeTable {
 struct ManifestResourceTable {
   static constexpr TableFlag id = TableFlag::ManifestResource;
 
-  // TODO: fields
+  dword offset;
+  dword flags;
+  dword name;
+  dword implementation;
 
   struct meta : protected TableMeta_ {
 
     meta(const IndexSize& hs)
       : TableMeta_(hs) {}
 
+    void from_bytes(const char* src, ManifestResourceTable& dst) const {
+      dst.offset = IndexSize::get_val<dword>::f(src);
+      dst.flags = IndexSize::get_val<dword>::f(src);
+      dst.name = _hs->heap.get_idx_string(src);
+      dst.implementation = _hs->coded_cols.get_idx_coded(src, Implementation::id);
+    }
+
     size_t row_size() const {
       return 2 * sizeof(dword)
         + _hs->heap.string
@@ -785,13 +985,19 @@ struct ManifestResourceTable {
 struct NestedClassTable {
   static constexpr TableFlag id = TableFlag::NestedClass;
 
-  // TODO: fields
+  dword nested_class;
+  dword enclosing_class;
 
   struct meta : protected TableMeta_ {
 
     meta(const IndexSize& hs)
       : TableMeta_(hs) {}
 
+    void from_bytes(const char* src, NestedClassTable& dst) const {
+      dst.nested_class = _hs->plain_cols.get_idx_plain(src, TableFlag::TypeDef);
+      dst.enclosing_class = _hs->plain_cols.get_idx_plain(src, TableFlag::TypeDef);
+    }
+
     size_t row_size() const {
       return 2 * _hs->plain_cols[TableFlag::TypeDef];
     }
@@ -819,15 +1025,21 @@ struct GenericParamTable {
 struct MethodSpecTable {
   static constexpr TableFlag id = TableFlag::MethodSpec;
 
-  // TODO: fields
+  dword method;
+  dword instantiation;
 
   struct meta : protected TableMeta_ {
 
     meta(const IndexSize& hs)
       : TableMeta_(hs) {}
 
+    void from_bytes(const char* src, MethodSpecTable& dst) const {
+      dst.method = _hs->coded_cols.get_idx_coded(src, MethodDefOrRef::id);
+      dst.instantiation = _hs->heap.get_idx_blob(src);
+    }
+
     size_t row_size() const {
-      return _hs->coded_cols[TypeOrMethodDef::id]
+      return _hs->coded_cols[MethodDefOrRef::id]
         + _hs->heap.blob;
     }
   }; 
@@ -864,10 +1076,14 @@ TABLE_SIZE_GETTER_(ClassLayout);
 TABLE_SIZE_GETTER_(Constant);
 TABLE_SIZE_GETTER_(CustomAttribute);
 TABLE_SIZE_GETTER_(DeclSecurity);
+TABLE_SIZE_GETTER_(ENCLog);
+TABLE_SIZE_GETTER_(ENCMap);
 TABLE_SIZE_GETTER_(EventMap);
 TABLE_SIZE_GETTER_(Event);
+TABLE_SIZE_GETTER_(EventPtr);
 TABLE_SIZE_GETTER_(ExportedType);
 TABLE_SIZE_GETTER_(Field);
+TABLE_SIZE_GETTER_(FieldPtr);
 TABLE_SIZE_GETTER_(FieldLayout);
 TABLE_SIZE_GETTER_(FieldMarshal);
 TABLE_SIZE_GETTER_(FieldRVA);
@@ -879,6 +1095,7 @@ TABLE_SIZE_GETTER_(InterfaceImpl);
 TABLE_SIZE_GETTER_(ManifestResource);
 TABLE_SIZE_GETTER_(MemberRef);
 TABLE_SIZE_GETTER_(MethodDef);
+TABLE_SIZE_GETTER_(MethodPtr);
 TABLE_SIZE_GETTER_(MethodImpl);
 TABLE_SIZE_GETTER_(MethodSemantics);
 TABLE_SIZE_GETTER_(MethodSpec);
@@ -886,7 +1103,9 @@ TABLE_SIZE_GETTER_(Module);
 TABLE_SIZE_GETTER_(ModuleRef);
 TABLE_SIZE_GETTER_(NestedClass);
 TABLE_SIZE_GETTER_(Param);
+TABLE_SIZE_GETTER_(ParamPtr);
 TABLE_SIZE_GETTER_(Property);
+TABLE_SIZE_GETTER_(PropertyPtr);
 TABLE_SIZE_GETTER_(PropertyMap);
 TABLE_SIZE_GETTER_(StandAloneSig);
 TABLE_SIZE_GETTER_(TypeDef);
@@ -0,0 +1,202 @@
+#pragma once
+
+#ifndef TRIAGE_HPP_
+#define TRIAGE_HPP_
+
+#include <algorithm>
+#include <cstddef>
+#include <cstring>
+
+#include "declarations.hpp"
+
+
+static constexpr size_t TRIAGE_WINDOW = 4096;
+static constexpr size_t CLI_HEADER_DATA_DIR = 14;
+
+static constexpr word OPT_MAGIC_PE32     = 0x010b;
+static constexpr word OPT_MAGIC_PE32PLUS = 0x020b;
+
+enum class image_kind : byte {
+  corrupt,
+  native,
+  managed,
+  ready_to_run,
+};
+
+static const char* to_string(image_kind kind) {
+  switch (kind) {
+    case image_kind::corrupt:      return "corrupt";
+    case image_kind::native:       return "native";
+    case image_kind::managed:      return "managed";
+    case image_kind::ready_to_run: return "r2r";
+  }
+
+  return "";
+}
+
+struct triage_info {
+  image_kind  kind = image_kind::corrupt;
+  const char* reason = nullptr;   // why the image is corrupt
+
+  word   machine = 0;
+  word   magic = 0;               // optional header magic
+  size_t opt_offset = 0;          // optional header, from the start of the file
+  size_t dirs_offset = 0;         // data directories, from the start of the file
+  dword  num_data_dirs = 0;
+  size_t sections_offset = 0;     // section table, from the start of the file
+
+  DataDirsEntry cli = {};
+
+  bool is_managed() const {
+    return kind == image_kind::managed || kind == image_kind::ready_to_run;
+  }
+};
+
+/*
+
+  ReadyToRun images carry the target machine XOR-ed with an OS-specific
+  constant (Linux, Apple, FreeBSD, NetBSD, SunOS), so that the Windows loader
+  refuses them. Plain x86/x64/ARM/ARM64 values are left to the CLI header check.
+
+*/
+static bool is_r2r_machine(word machine) {
+  static constexpr word os_overrides[] = { 0x7B79, 0x4644, 0xADC4, 0x1993, 0x1ECA };
+  static constexpr word machines[] = { 0x014c, 0x8664, 0x01c4, 0xAA64 };
+
+  for (auto os : os_overrides) {
+    for (auto m : machines) {
+      if ((machine ^ os) == m) {
+        return true;
+      }
+    }
+  }
+
+  return false;
+}
+
+/*
+
+  Classifies an image by its first bytes only (up to TRIAGE_WINDOW):
+  MZ and PE signatures, optional header magic and the CLI data directory.
+  When the CLI header itself happens to be inside the window it is used
+  to tell ReadyToRun images apart.
+
+*/
+static triage_info triage_image(const char* head, size_t size) {
+  triage_info info;
+
+  auto corrupt = [&info] (const char* reason) {
+    info.kind = image_kind::corrupt;
+    info.reason = reason;
+    return info;
+  };
+
+  HDR_MSDOS hdrMsDos;
+  if (size < sizeof(hdrMsDos)) {
+    return corrupt("Not a PE image");
+  }
+
+  memcpy(&hdrMsDos, head, sizeof(hdrMsDos));
+  if (hdrMsDos.sig[0] != 'M' || hdrMsDos.sig[1] != 'Z') {
+    return corrupt("Not a PE image");
+  }
+
+  HDR_COFF hdrCoff;
+  if (size < sizeof(hdrCoff) || hdrMsDos.e_lfanew > size - sizeof(hdrCoff)) {
+    return corrupt("PE header is out of range");
+  }
+
+  memcpy(&hdrCoff, head + hdrMsDos.e_lfanew, sizeof(hdrCoff));
+  if (memcmp(hdrCoff.sig, "PE\0\0", sizeof(hdrCoff.sig))) {
+    return corrupt("Not a PE image");
+  }
+
+  info.machine = hdrCoff.machine;
+  info.opt_offset = hdrMsDos.e_lfanew + sizeof(hdrCoff);
+  info.sections_offset = info.opt_offset + hdrCoff.sz_hdropt;
+
+  if (info.opt_offset + sizeof(word) > size) {
+    return corrupt("Optional header is out of range");
+  }
+
+  memcpy(&info.magic, head + info.opt_offset, sizeof(info.magic));
+
+  // PE32+ drops base_of_data and widens image base and stack/heap sizes,
+  // so the data directories move; the optional header size bounds them.
+  size_t fixedSize;
+  switch (info.magic) {
+    case OPT_MAGIC_PE32:
+      fixedSize = sizeof(HDR_COFF_STD) + sizeof(HDR_COFF_WIN);
+      break;
+    case OPT_MAGIC_PE32PLUS:
+      fixedSize = sizeof(HDR_COFF_STD64) + sizeof(HDR_COFF_WIN64);
+      break;
+    default:
+      return corrupt("Unknown optional header magic");
+  }
+
+  if (hdrCoff.sz_hdropt < fixedSize) {
+    return corrupt("Optional header is truncated");
+  }
+
+  info.dirs_offset = info.opt_offset + fixedSize;
+  if (info.dirs_offset > size) {
+    return corrupt("Optional header is out of range");
+  }
+
+  memcpy(&info.num_data_dirs, head + info.dirs_offset - sizeof(dword), sizeof(dword));
+  info.num_data_dirs = dword(std::min<size_t>(info.num_data_dirs,
+    (hdrCoff.sz_hdropt - fixedSize) / sizeof(DataDirsEntry)));
+
+  if (info.num_data_dirs <= CLI_HEADER_DATA_DIR) {
+    info.kind = image_kind::native;
+    return info;
+  }
+
+  auto cliDirOffset = info.dirs_offset + CLI_HEADER_DATA_DIR * sizeof(DataDirsEntry);
+  if (cliDirOffset + sizeof(DataDirsEntry) > size) {
+    return corrupt("Data directories are out of range");
+  }
+
+  memcpy(&info.cli, head + cliDirOffset, sizeof(info.cli));
+  if (info.cli.rva == 0 || info.cli.sz == 0) {
+    info.kind = image_kind::native;
+    return info;
+  }
+
+  if (info.cli.sz < offsetof(HDR_CLI, flags)) {
+    return corrupt("CLI header is truncated");
+  }
+
+  info.kind = is_r2r_machine(info.machine)
+    ? image_kind::ready_to_run : image_kind::managed;
+
+  // The CLI header is commonly right at the start of .text, often inside the window.
+  if (info.kind == image_kind::managed) {
+    auto ofs = info.sections_offset;
+    for (word i = 0; i < hdrCoff.num_sections
+        && ofs + sizeof(SectionHeadersEntry) <= size; ++i, ofs += sizeof(SectionHeadersEntry)) {
+
+      SectionHeadersEntry entry;
+      memcpy(&entry, head + ofs, sizeof(entry));
+
+      if (entry.rva <= info.cli.rva && info.cli.rva + sizeof(HDR_CLI) <= entry.rva + entry.sz_raw) {
+        auto cliOfs = size_t(entry.file_offset) + info.cli.rva - entry.rva;
+        if (cliOfs + sizeof(HDR_CLI) <= size) {
+          HDR_CLI hdrCli;
+          memcpy(&hdrCli, head + cliOfs, sizeof(hdrCli));
+
+          if (hdrCli.native_header.rva != 0) {
+            info.kind = image_kind::ready_to_run;
+          }
+        }
+
+        break;
+      }
+    }
+  }
+
+  return info;
+}
+
+#endif // TRIAGE_HPP_
@@ -0,0 +1,153 @@
+#pragma once
+
+#ifndef USER_STRINGS_HPP_
+#define USER_STRINGS_HPP_
+
+#include <algorithm>
+#include <string>
+#include <emmintrin.h>
+
+#include "declarations.hpp"
+#include "metadata.hpp"
+
+
+// Table byte of the ldstr tokens, their row is an offset into #US.
+static constexpr byte USER_STRING_TOKEN = 0x70;
+
+static constexpr dword REPLACEMENT_CHARACTER = 0xFFFD;
+
+/*
+
+  Appends little-endian UTF-16 code units as UTF-8. Literals are mostly
+  ASCII, so runs of 8 units are checked at once and narrowed with one pack
+  while all of them are below 0x80; the other blocks go unit by unit.
+  Unpaired surrogates become U+FFFD.
+
+*/
+static void append_utf8(std::string& out, const byte* src, size_t units) {
+  const auto notAscii = _mm_set1_epi16(short(0xFF80));
+
+  out.reserve(out.size() + units);
+
+  size_t i = 0;
+  while (i < units) {
+    for (; units - i >= 8; i += 8) {
+      auto v = _mm_loadu_si128(reinterpret_cast<const __m128i*>(src + i * 2));
+      auto ascii = _mm_cmpeq_epi16(_mm_and_si128(v, notAscii), _mm_setzero_si128());
+      if (_mm_movemask_epi8(ascii) != 0xFFFF) {
+        break;
+      }
+
+      char narrowed[16];
+      _mm_storeu_si128(reinterpret_cast<__m128i*>(narrowed), _mm_packus_epi16(v, v));
+      out.append(narrowed, 8);
+    }
+
+    auto blockEnd = std::min(units, i + 8);
+    while (i < blockEnd) {
+      dword c = src[i * 2] | dword(src[i * 2 + 1]) << 8;
+      ++i;
+
+      if (c >= 0xD800 && c < 0xDC00 && i < units) {
+        dword low = src[i * 2] | dword(src[i * 2 + 1]) << 8;
+        if (low >= 0xDC00 && low < 0xE000) {
+          c = 0x10000 + ((c - 0xD800) << 10) + (low - 0xDC00);
+          ++i;
+        }
+      }
+
+      if (c >= 0xD800 && c < 0xE000) {
+        c = REPLACEMENT_CHARACTER;
+      }
+
+      if (c < 0x80) {
+        out += char(c);
+      } else if (c < 0x800) {
+        out += char(0xC0 | c >> 6);
+        out += char(0x80 | (c & 0x3F));
+      } else if (c < 0x10000) {
+        out += char(0xE0 | c >> 12);
+        out += char(0x80 | (c >> 6 & 0x3F));
+        out += char(0x80 | (c & 0x3F));
+      } else {
+        out += char(0xF0 | c >> 18);
+        out += char(0x80 | (c >> 12 & 0x3F));
+        out += char(0x80 | (c >> 6 & 0x3F));
+        out += char(0x80 | (c & 0x3F));
+      }
+    }
+  }
+}
+
+/*
+
+  The #US heap (II.24.2.4) of string literals. Entries have the length
+  prefix of blobs, then the UTF-16 code units and one more byte flagging
+  the units that need more than an ordinal comparison. Offset 0 is the
+  empty string, zeros pad the heap's end.
+
+*/
+class user_strings {
+public:
+  explicit user_strings(const metadata& meta) {
+    if (auto stream = meta.find_stream("#US")) {
+      _heap = meta.base + stream->ofs;
+      _size = stream->sz;
+    }
+  }
+
+  size_t size() const {
+    return _size;
+  }
+
+  // The entry at offset as UTF-8, false if there is none.
+  bool get(dword offset, std::string& out) const {
+    dword length;
+    auto header = offset < _size ? metadata::read_blob_length(_heap + offset, _size - offset, length) : 0;
+    if (!header || length > _size - offset - header) {
+      return false;
+    }
+
+    append_utf8(out, reinterpret_cast<const byte*>(_heap + offset + header), length / 2);
+    return true;
+  }
+
+  /*
+
+    Streams the heap from the start, calling f(offset, text) for every
+    non-empty entry until f returns false; text is only valid during the
+    call. Returns false if the heap is malformed, entries up to there have
+    been handed out.
+
+  */
+  template<class F>
+  bool for_each(F&& f) const {
+    std::string text;
+
+    for (size_t offset = 1; offset < _size;) {
+      dword length;
+      auto header = metadata::read_blob_length(_heap + offset, _size - offset, length);
+      if (!header || length > _size - offset - header) {
+        return false;
+      }
+
+      if (length / 2) {
+        text.clear();
+        append_utf8(text, reinterpret_cast<const byte*>(_heap + offset + header), length / 2);
+        if (!f(dword(offset), text)) {
+          return true;
+        }
+      }
+
+      offset += header + length;
+    }
+
+    return true;
+  }
+
+private:
+  const char* _heap = nullptr;
+  size_t _size = 0;
+};
+
+#endif // USER_STRINGS_HPP_
@@ -151,4 +151,9 @@ constexpr N round_up(size_t boundary, N value) {
   return (value + boundary) & ~boundary;
 }
 
+template<class N>
+constexpr N round_down(size_t boundary, N value) {
+  return value & ~(boundary - 1);
+}
+
 #endif // UTILITY_HPP_